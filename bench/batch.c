@@ -0,0 +1,91 @@
+#include "bench.h"
+
+#include "../src/strand.h"
+
+#define SWITCHES (1 << 24)
+
+static uintptr_t
+idle (void *data, uintptr_t val)
+{
+	(void)data;
+	while (true) {
+		val = strand_yield (val);
+	}
+	return 0;
+}
+
+/**
+ * Resumes a shuffled list of coroutines round-robin, first with a plain loop
+ * and then with `strand_resume_batch`
+ *
+ * The list is shuffled so that consecutive entries are not adjacent in
+ * memory, as with a scheduler whose ready order is unrelated to creation
+ * order, and the hardware prefetchers cannot follow it.
+ *
+ * @param  count  number of coroutines
+ */
+static void
+run (size_t count)
+{
+	char label[64];
+	Strand **list = calloc (count, sizeof (*list));
+	uintptr_t *results = calloc (count, sizeof (*results));
+	if (list == NULL || results == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		// unprotected stacks merge into fewer mappings
+		list[i] = strand_new_config (STRAND_STACK_MIN, STRAND_FCOLOR, idle, NULL);
+		if (list[i] == NULL) {
+			fprintf (stderr, "failed to create coroutine %zu\n", i);
+			exit (1);
+		}
+	}
+	srand (1);
+	for (size_t i = count - 1; i > 0; i--) {
+		size_t j = (size_t)rand () % (i + 1);
+		Strand *tmp = list[i];
+		list[i] = list[j];
+		list[j] = tmp;
+	}
+	for (size_t i = 0; i < count; i++) {
+		strand_resume (list[i], 0);
+	}
+
+	size_t rounds = SWITCHES / count;
+	uint64_t start = bench_now ();
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < count; i++) {
+			results[i] = strand_resume (list[i], 0);
+		}
+	}
+	uint64_t ns = bench_now () - start;
+	snprintf (label, sizeof label, "resume loop, %zu coroutines", count);
+	bench_report (label, (uint64_t)count * rounds, ns);
+
+	start = bench_now ();
+	for (size_t r = 0; r < rounds; r++) {
+		strand_resume_batch (list, count, results);
+	}
+	ns = bench_now () - start;
+	snprintf (label, sizeof label, "resume batch, %zu coroutines", count);
+	bench_report (label, (uint64_t)count * rounds, ns);
+
+	for (size_t i = 0; i < count; i++) {
+		strand_free (&list[i]);
+	}
+	free (results);
+	free (list);
+}
+
+int
+main (void)
+{
+	run (16);
+	run (1024);
+	run (16384);
+	run (65536);
+	return 0;
+}
+
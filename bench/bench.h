@@ -0,0 +1,75 @@
+#ifndef BENCH_INCLUDED
+#define BENCH_INCLUDED
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Gets a monotonic timestamp in nanoseconds
+ */
+static inline uint64_t
+bench_now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Prints a result line for an operation that was repeated `count` times
+ *
+ * @param  name   label for the result
+ * @param  count  number of operations
+ * @param  ns     total elapsed nanoseconds
+ */
+static inline void
+bench_report (const char *name, uint64_t count, uint64_t ns)
+{
+	printf ("%-40s %12" PRIu64 " ops %12.3f ms %10.2f ns/op\n",
+			name, count, ns / 1e6, count ? (double)ns / count : 0.0);
+	fflush (stdout);
+}
+
+static int
+bench_cmp (const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Prints the distribution of a set of latency samples
+ *
+ * The samples are sorted in place.
+ *
+ * @param  name     label for the result
+ * @param  samples  latencies in nanoseconds
+ * @param  n        number of samples
+ */
+static inline void
+bench_latency (const char *name, uint64_t *samples, size_t n)
+{
+	if (n == 0) {
+		return;
+	}
+	qsort (samples, n, sizeof (*samples), bench_cmp);
+	printf ("%-40s %12zu ops p50 %10.2f us p99 %10.2f us max %10.2f us\n",
+			name, n,
+			samples[n / 2] / 1e3,
+			samples[n * 99 / 100] / 1e3,
+			samples[n - 1] / 1e3);
+	fflush (stdout);
+}
+
+/**
+ * Prevents the compiler from optimizing away a computed value
+ */
+#define bench_use(v) __asm__ __volatile__ ("" : : "r" (v) : "memory")
+
+#endif
+
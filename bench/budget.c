@@ -0,0 +1,95 @@
+#include "bench.h"
+
+#include "../src/strand.h"
+
+#define CPU_COUNT  4
+#define IO_COUNT   16
+#define CPU_BURST  2000000
+#define RUN_NS     500000000
+#define QUANTUM    50000
+#define MAX_SAMPLES (1 << 20)
+
+static uint64_t samples[MAX_SAMPLES];
+static size_t nsamples;
+static uint64_t stop_at;
+
+/**
+ * Simulates a compute-bound request that runs for a burst before yielding
+ */
+static uintptr_t
+cpu_main (void *data, uintptr_t val)
+{
+	(void)data;
+	(void)val;
+
+	uint64_t x = 1;
+	while (bench_now () < stop_at) {
+		uint64_t end = bench_now () + CPU_BURST;
+		while (bench_now () < end) {
+			for (int i = 0; i < 64; i++) {
+				x = x * UINT64_C(6364136223846793005) + 1;
+			}
+			strand_maybe_yield ();
+		}
+		bench_use (x);
+		strand_sched_yield (0);
+	}
+	return 0;
+}
+
+/**
+ * Simulates an I/O-bound request that records how long it waits to run
+ */
+static uintptr_t
+io_main (void *data, uintptr_t val)
+{
+	(void)data;
+	(void)val;
+
+	while (bench_now () < stop_at) {
+		uint64_t ready = bench_now ();
+		strand_sched_yield (0);
+		if (nsamples < MAX_SAMPLES) {
+			samples[nsamples++] = bench_now () - ready;
+		}
+	}
+	return 0;
+}
+
+static void
+run (const char *name, uint64_t quantum, uint32_t flags)
+{
+	StrandBudgetStats before, after;
+
+	if (strand_budget (quantum, flags) < 0) {
+		printf ("%-40s unsupported\n", name);
+		return;
+	}
+	strand_budget_stats (&before);
+
+	nsamples = 0;
+	stop_at = bench_now () + RUN_NS;
+	for (int i = 0; i < CPU_COUNT; i++) {
+		strand_spawn (cpu_main, NULL);
+	}
+	for (int i = 0; i < IO_COUNT; i++) {
+		strand_spawn (io_main, NULL);
+	}
+	strand_sched_run ();
+
+	strand_budget_stats (&after);
+	strand_budget (0, 0);
+
+	bench_latency (name, samples, nsamples);
+	printf ("%-40s %12" PRIu64 " expired of %" PRIu64 " slices\n", "",
+			after.expired - before.expired, after.slices - before.slices);
+}
+
+int
+main (void)
+{
+	run ("io wait, no budget", 0, 0);
+	run ("io wait, 50us budget", QUANTUM, 0);
+	run ("io wait, 50us budget (timer)", QUANTUM, STRAND_BUDGET_FTIMER);
+	return 0;
+}
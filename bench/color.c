@@ -0,0 +1,92 @@
+#include "bench.h"
+
+#include "../src/strand.h"
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define COUNT  1024
+#define ROUNDS 800
+
+static Strand *list[COUNT];
+
+/**
+ * Touches a few lines at the top of the stack on every switch
+ */
+static uintptr_t
+hot (void *data, uintptr_t val)
+{
+	(void)data;
+	volatile uint64_t frame[32];
+	while (true) {
+		for (size_t i = 0; i < 32; i += 8) {
+			frame[i] += val;
+		}
+		val = strand_yield (frame[0]);
+	}
+	return 0;
+}
+
+static void
+run (const char *name, uint32_t flags)
+{
+	char label[64];
+	int perf = strand_perf_enable (true);
+
+	for (int i = 0; i < COUNT; i++) {
+		list[i] = strand_new_config (STRAND_STACK_DEFAULT, flags, hot, NULL);
+	}
+
+	// warm up so each stack top is resident
+	for (int i = 0; i < COUNT; i++) {
+		strand_resume (list[i], 0);
+	}
+
+	uint64_t start = bench_now ();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (int i = 0; i < COUNT; i++) {
+			strand_resume (list[i], r);
+		}
+	}
+	uint64_t ns = bench_now () - start;
+
+	uint64_t misses = 0;
+	for (int i = 0; i < COUNT; i++) {
+		StrandPerf p;
+		strand_perf (list[i], &p);
+		misses += p.cache_misses;
+		strand_free (&list[i]);
+	}
+	strand_perf_enable (false);
+
+	snprintf (label, sizeof label, "round-robin, %s", name);
+	bench_report (label, (uint64_t)COUNT * ROUNDS, ns);
+	if (perf == 0) {
+		printf ("%-40s %12.3f cache misses/switch\n", "",
+				(double)misses / ((double)COUNT * ROUNDS));
+	}
+}
+
+/**
+ * Runs a measurement in a child process so that no mappings are reused
+ */
+static void
+run_fork (const char *name, uint32_t flags)
+{
+	pid_t pid = fork ();
+	if (pid == 0) {
+		run (name, flags);
+		exit (0);
+	}
+	if (pid > 0) {
+		waitpid (pid, NULL, 0);
+	}
+}
+
+int
+main (void)
+{
+	run_fork ("aligned stacks", STRAND_FPROTECT);
+	run_fork ("colored stacks", STRAND_FPROTECT|STRAND_FCOLOR);
+	return 0;
+}
@@ -0,0 +1,214 @@
+#include "bench.h"
+
+#include "../src/strand.h"
+
+#define BUILD (UINT64_C(1) << 23)
+#define BUCKETS BUILD
+#define PROBES (UINT64_C(1) << 22)
+#define GROUP_MAX 64
+
+/**
+ * Entry of a chained hash table
+ *
+ * Nodes are placed in random order, so walking a chain is a series of
+ * dependent cache misses.
+ */
+typedef struct Node Node;
+struct Node {
+	uint64_t key;
+	uint64_t value;
+	Node *next;
+};
+
+static Node **buckets;
+static Node *nodes;
+static uint64_t *probes;
+
+static inline uint64_t
+hash (uint64_t key)
+{
+	return ((key * UINT64_C(0x9e3779b97f4a7c15)) >> 40) % BUCKETS;
+}
+
+static uint64_t
+random64 (void)
+{
+	return ((uint64_t)rand () << 31) ^ (uint64_t)rand ();
+}
+
+static void
+build (void)
+{
+	buckets = calloc (BUCKETS, sizeof (*buckets));
+	nodes = malloc (BUILD * sizeof (*nodes));
+	probes = malloc (PROBES * sizeof (*probes));
+	uint64_t *order = malloc (BUILD * sizeof (*order));
+	if (buckets == NULL || nodes == NULL || probes == NULL || order == NULL) {
+		fprintf (stderr, "failed to allocate table\n");
+		exit (1);
+	}
+
+	srand (1);
+	for (uint64_t i = 0; i < BUILD; i++) {
+		order[i] = i;
+	}
+	for (uint64_t i = BUILD - 1; i > 0; i--) {
+		uint64_t j = random64 () % (i + 1), tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (uint64_t i = 0; i < BUILD; i++) {
+		Node *n = &nodes[order[i]];
+		n->key = (i + 1) * 7919;
+		n->value = i + 1;
+		uint64_t h = hash (n->key);
+		n->next = buckets[h];
+		buckets[h] = n;
+	}
+	free (order);
+
+	for (uint64_t i = 0; i < PROBES; i++) {
+		probes[i] = (random64 () % BUILD + 1) * 7919;
+	}
+}
+
+static uint64_t
+lookup (uint64_t key)
+{
+	for (Node *n = buckets[hash (key)]; n != NULL; n = n->next) {
+		if (n->key == key) {
+			return n->value;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Looks up a key, switching away before each load that is likely to miss
+ */
+static uint64_t
+lookup_interleaved (uint64_t key, void (*wait)(const void *))
+{
+	Node **b = &buckets[hash (key)];
+	wait (b);
+	for (Node *n = *b; n != NULL; n = n->next) {
+		wait (n);
+		if (n->key == key) {
+			return n->value;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Prefetches and yields to the driving loop
+ */
+static void
+prefetch_yield_parent (const void *addr)
+{
+	__builtin_prefetch (addr);
+	strand_yield (0);
+}
+
+typedef struct {
+	uint64_t begin, step, sum;
+	void (*wait) (const void *);
+} Probe;
+
+static uintptr_t
+probe_main (void *data, uintptr_t val)
+{
+	(void)val;
+	Probe *p = data;
+	for (uint64_t i = p->begin; i < PROBES; i += p->step) {
+		p->sum += lookup_interleaved (probes[i], p->wait);
+	}
+	return 0;
+}
+
+static uint64_t
+run_sequential (void)
+{
+	uint64_t sum = 0;
+	uint64_t start = bench_now ();
+	for (uint64_t i = 0; i < PROBES; i++) {
+		sum += lookup (probes[i]);
+	}
+	bench_report ("probe: sequential", PROBES, bench_now () - start);
+	return sum;
+}
+
+/**
+ * Probes with a group of coroutines that each take every `n`th key
+ *
+ * @param  n      number of coroutines
+ * @param  group  use `strand_group_run` rather than resuming each in turn
+ * @return  sum of the values found
+ */
+static uint64_t
+run_interleaved (size_t n, bool group)
+{
+	char label[64];
+	Probe p[GROUP_MAX];
+	Strand *list[GROUP_MAX];
+
+	for (size_t i = 0; i < n; i++) {
+		p[i] = (Probe) {
+			.begin = i, .step = n,
+			.wait = group ? strand_prefetch_yield : prefetch_yield_parent,
+		};
+		list[i] = strand_new_config (STRAND_STACK_MIN, STRAND_FLAGS_DEFAULT, probe_main, &p[i]);
+	}
+
+	uint64_t start = bench_now ();
+	if (group) {
+		strand_group_run (list, n);
+	}
+	else {
+		size_t alive = n;
+		while (alive > 0) {
+			alive = 0;
+			for (size_t i = 0; i < n; i++) {
+				if (strand_alive (list[i])) {
+					strand_resume (list[i], 0);
+					alive++;
+				}
+			}
+		}
+	}
+	uint64_t ns = bench_now () - start;
+
+	snprintf (label, sizeof label, "probe: %zu coroutines, %s",
+			n, group ? "group" : "resume loop");
+	bench_report (label, PROBES, ns);
+
+	uint64_t sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		sum += p[i].sum;
+		strand_free (&list[i]);
+	}
+	return sum;
+}
+
+int
+main (void)
+{
+	build ();
+
+	uint64_t expect = run_sequential ();
+	static const size_t sizes[] = { 4, 8, 16, 32 };
+	for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		if (run_interleaved (sizes[i], false) != expect ||
+				run_interleaved (sizes[i], true) != expect) {
+			fprintf (stderr, "probe results differ\n");
+			return 1;
+		}
+	}
+
+	free (probes);
+	free (nodes);
+	free (buckets);
+	return 0;
+}
+
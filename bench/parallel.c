@@ -0,0 +1,107 @@
+#include "bench.h"
+
+#include "../src/parallel.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define COUNT  (UINT64_C(1) << 26)
+#define GRAIN  (UINT64_C(1) << 14)
+#define ROUNDS 5
+
+static uint64_t
+work (uint64_t i)
+{
+	// cheap integer hash to give each index a little CPU work
+	i ^= i >> 33;
+	i *= UINT64_C(0xff51afd7ed558ccd);
+	i ^= i >> 33;
+	return i & 0xffff;
+}
+
+static void
+reduce_range (void *data, size_t begin, size_t end)
+{
+	uint64_t sum = 0;
+	for (size_t i = begin; i < end; i++) {
+		sum += work (i);
+	}
+	__sync_fetch_and_add ((uint64_t *)data, sum);
+}
+
+typedef struct {
+	pthread_t thread;
+	uint64_t begin, end, *sum;
+} Split;
+
+static void *
+split_main (void *data)
+{
+	Split *s = data;
+	reduce_range (s->sum, s->begin, s->end);
+	return NULL;
+}
+
+static uint64_t
+run_pthread (unsigned n)
+{
+	Split split[n];
+	uint64_t sum = 0;
+	for (unsigned i = 0; i < n; i++) {
+		split[i].begin = COUNT * i / n;
+		split[i].end = COUNT * (i + 1) / n;
+		split[i].sum = &sum;
+		pthread_create (&split[i].thread, NULL, split_main, &split[i]);
+	}
+	for (unsigned i = 0; i < n; i++) {
+		pthread_join (split[i].thread, NULL);
+	}
+	return sum;
+}
+
+static uint64_t
+run_strand (void)
+{
+	uint64_t sum = 0;
+	strand_parallel_for (0, COUNT, GRAIN, reduce_range, &sum);
+	return sum;
+}
+
+int
+main (void)
+{
+	long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	unsigned n = cpus > 0 ? (unsigned)cpus : 1;
+	uint64_t start, a = 0, b = 0;
+
+	strand_parallel_start (n);
+
+	// warm up the worker pool and stack cache
+	run_strand ();
+
+	start = bench_now ();
+	for (int i = 0; i < ROUNDS; i++) {
+		a = run_pthread (n);
+	}
+	bench_report ("parallel reduce: pthread split", ROUNDS * COUNT, bench_now () - start);
+
+	start = bench_now ();
+	for (int i = 0; i < ROUNDS; i++) {
+		b = run_strand ();
+	}
+	bench_report ("parallel reduce: strand_parallel_for", ROUNDS * COUNT, bench_now () - start);
+
+	StrandParkStats st;
+	strand_parallel_stats (&st);
+	printf ("%-40s %12" PRIu64 " parks %8" PRIu64 " spins %8" PRIu64 " wakes %8" PRIu64 " spurious\n",
+			"", st.parks, st.spins, st.wakes, st.spurious);
+
+	strand_parallel_stop ();
+
+	if (a != b) {
+		fprintf (stderr, "result mismatch: %" PRIu64 " != %" PRIu64 "\n", a, b);
+		return 1;
+	}
+	return 0;
+}
+
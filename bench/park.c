@@ -0,0 +1,114 @@
+#include "bench.h"
+
+#include "../src/park.h"
+
+#include <pthread.h>
+
+#define ROUNDS 20000
+
+/**
+ * A one-way signal between two threads
+ */
+typedef struct {
+	StrandPark park;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t value;
+	uint64_t want;
+} Signal;
+
+static Signal ping = {
+	.park = STRAND_PARK_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+static Signal pong = {
+	.park = STRAND_PARK_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static bool use_park;
+
+static bool
+arrived (void *data)
+{
+	Signal *s = data;
+	return __atomic_load_n (&s->value, __ATOMIC_SEQ_CST) >= s->want;
+}
+
+static void
+send (Signal *s, uint64_t val)
+{
+	if (use_park) {
+		__atomic_store_n (&s->value, val, __ATOMIC_SEQ_CST);
+		strand_park_notify (&s->park, 1);
+	}
+	else {
+		pthread_mutex_lock (&s->lock);
+		s->value = val;
+		pthread_cond_signal (&s->cond);
+		pthread_mutex_unlock (&s->lock);
+	}
+}
+
+static void
+receive (Signal *s, uint64_t val)
+{
+	s->want = val;
+	if (use_park) {
+		strand_park_wait (&s->park, arrived, s);
+	}
+	else {
+		pthread_mutex_lock (&s->lock);
+		while (s->value < val) {
+			pthread_cond_wait (&s->cond, &s->lock);
+		}
+		pthread_mutex_unlock (&s->lock);
+	}
+}
+
+static void *
+echo (void *data)
+{
+	(void)data;
+	for (uint64_t i = 1; i <= ROUNDS; i++) {
+		receive (&ping, i);
+		send (&pong, i);
+	}
+	return NULL;
+}
+
+static void
+run (const char *name, bool park)
+{
+	static uint64_t samples[ROUNDS];
+	pthread_t thread;
+
+	use_park = park;
+	ping.value = pong.value = 0;
+	pthread_create (&thread, NULL, echo, NULL);
+
+	for (uint64_t i = 1; i <= ROUNDS; i++) {
+		uint64_t start = bench_now ();
+		send (&ping, i);
+		receive (&pong, i);
+		samples[i - 1] = bench_now () - start;
+	}
+	pthread_join (thread, NULL);
+
+	bench_latency (name, samples, ROUNDS);
+}
+
+int
+main (void)
+{
+	run ("wake round trip: condition variable", false);
+	run ("wake round trip: park", true);
+
+	StrandParkStats st;
+	strand_park_stats (&ping.park, &st);
+	printf ("%-40s %12" PRIu64 " parks %8" PRIu64 " spins %8" PRIu64 " wakes %8" PRIu64 " spurious\n",
+			"", st.parks, st.spins, st.wakes, st.spurious);
+	return 0;
+}
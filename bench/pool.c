@@ -0,0 +1,62 @@
+#include "bench.h"
+
+#include "../src/pool.h"
+
+#define COUNT 2000000
+
+/**
+ * Handles a request using a few kilobytes of stack
+ */
+static void
+handle (void *arg)
+{
+	volatile uint8_t buf[2048];
+	for (size_t i = 0; i < sizeof buf; i += 64) {
+		buf[i] = (uint8_t)(uintptr_t)arg;
+	}
+}
+
+static uintptr_t
+handle_strand (void *data, uintptr_t val)
+{
+	(void)val;
+	handle (data);
+	return 0;
+}
+
+static void
+run_spawn (void)
+{
+	uint64_t start = bench_now ();
+	for (uintptr_t i = 0; i < COUNT; i++) {
+		Strand *s = strand_new (handle_strand, (void *)i);
+		strand_resume (s, 0);
+		strand_free (&s);
+	}
+	bench_report ("coroutine per request", COUNT, bench_now () - start);
+}
+
+static void
+run_pool (void)
+{
+	StrandPool *p = strand_pool_new (1, 0);
+	if (p == NULL) {
+		return;
+	}
+
+	uint64_t start = bench_now ();
+	for (uintptr_t i = 0; i < COUNT; i++) {
+		strand_pool_submit (p, handle, (void *)i);
+	}
+	bench_report ("worker pool", COUNT, bench_now () - start);
+
+	strand_pool_free (&p);
+}
+
+int
+main (void)
+{
+	run_spawn ();
+	run_pool ();
+	return 0;
+}
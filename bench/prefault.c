@@ -0,0 +1,77 @@
+#include "bench.h"
+
+#include "../src/strand.h"
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define COUNT 4096
+#define TOUCH 12288
+
+static uint64_t create[COUNT], first[COUNT];
+
+/**
+ * Simulates a request that uses a few pages of stack on its first run
+ */
+static uintptr_t
+request (void *data, uintptr_t val)
+{
+	(void)data;
+	volatile uint8_t buf[TOUCH];
+	for (size_t i = 0; i < sizeof buf; i += 64) {
+		buf[i] = (uint8_t)i;
+	}
+	bench_use (buf[val % TOUCH]);
+	return 0;
+}
+
+static void
+run (const char *name, uint32_t flags)
+{
+	static Strand *list[COUNT];
+	char label[64];
+
+	// keep every coroutine alive so each one gets a fresh mapping
+	for (int i = 0; i < COUNT; i++) {
+		uint64_t t = bench_now ();
+		list[i] = strand_new_config (STRAND_STACK_DEFAULT, flags, request, NULL);
+		create[i] = bench_now () - t;
+	}
+	for (int i = 0; i < COUNT; i++) {
+		uint64_t t = bench_now ();
+		strand_resume (list[i], i);
+		first[i] = bench_now () - t;
+	}
+	for (int i = 0; i < COUNT; i++) {
+		strand_free (&list[i]);
+	}
+
+	snprintf (label, sizeof label, "create, %s", name);
+	bench_latency (label, create, COUNT);
+	snprintf (label, sizeof label, "first resume, %s", name);
+	bench_latency (label, first, COUNT);
+}
+
+/**
+ * Runs a measurement in a child process so that no mappings are reused
+ */
+static void
+run_fork (const char *name, uint32_t flags)
+{
+	pid_t pid = fork ();
+	if (pid == 0) {
+		run (name, flags);
+		exit (0);
+	}
+	if (pid > 0) {
+		waitpid (pid, NULL, 0);
+	}
+}
+
+int
+main (void)
+{
+	run_fork ("fresh stack", STRAND_FPROTECT);
+	run_fork ("fresh stack, prefault", STRAND_FPROTECT|STRAND_FPREFAULT);
+	return 0;
+}
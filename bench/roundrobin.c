@@ -0,0 +1,72 @@
+#include "bench.h"
+
+#include "../src/strand.h"
+
+#define SWITCHES (1 << 24)
+
+/**
+ * Yields without touching any memory of its own
+ */
+static uintptr_t
+idle (void *data, uintptr_t val)
+{
+	(void)data;
+	while (true) {
+		val = strand_yield (val);
+	}
+	return 0;
+}
+
+/**
+ * Resumes each coroutine in turn so the working set of a switch is only
+ * the coroutine object and the top of its stack
+ *
+ * @param  count  number of coroutines
+ */
+static void
+run (int count)
+{
+	char label[64];
+	Strand **list = calloc (count, sizeof (*list));
+	if (list == NULL) {
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		list[i] = strand_new_config (STRAND_STACK_MIN, STRAND_FLAGS_DEFAULT, idle, NULL);
+		if (list[i] == NULL) {
+			fprintf (stderr, "failed to create coroutine %d\n", i);
+			exit (1);
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		strand_resume (list[i], 0);
+	}
+
+	int rounds = SWITCHES / count;
+	uint64_t start = bench_now ();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < count; i++) {
+			strand_resume (list[i], r);
+		}
+	}
+	uint64_t ns = bench_now () - start;
+
+	snprintf (label, sizeof label, "round-robin, %d coroutines", count);
+	bench_report (label, (uint64_t)count * rounds, ns);
+
+	for (int i = 0; i < count; i++) {
+		strand_free (&list[i]);
+	}
+	free (list);
+}
+
+int
+main (void)
+{
+	run (16);
+	run (1024);
+	run (4096);
+	run (16384);
+	return 0;
+}
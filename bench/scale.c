@@ -0,0 +1,287 @@
+#include "bench.h"
+
+#include "../src/strand.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/**
+ * Minimum number of timed resumes for each order
+ */
+#define SAMPLES 1000000
+
+/**
+ * Stack configuration to measure
+ *
+ * Adjacent unprotected mappings are merged by the kernel, while a guard
+ * page splits each protected mapping in two.
+ */
+typedef struct {
+	const char *name;
+	uint32_t stack_size;
+	uint32_t flags;
+	int vmas; /** mappings added for each coroutine */
+} Config;
+
+static const Config configs[] = {
+	{ "16k",          STRAND_STACK_MIN,     0,                    0 },
+	{ "16k protect",  STRAND_STACK_MIN,     STRAND_FPROTECT,      2 },
+	{ "128k default", STRAND_STACK_DEFAULT, STRAND_FLAGS_DEFAULT, 2 },
+};
+
+static const size_t counts[] = { 10000, 100000, 1000000 };
+
+/**
+ * Yields without touching any memory of its own
+ */
+static uintptr_t
+idle (void *data, uintptr_t val)
+{
+	(void)data;
+	while (true) {
+		val = strand_yield (val);
+	}
+	return 0;
+}
+
+/**
+ * Reads a whole file from procfs into a static buffer
+ *
+ * @param  path  file path
+ * @param  len   set to the number of bytes read
+ * @return  buffer or `NULL` on error
+ */
+static const char *
+proc_read (const char *path, size_t *len)
+{
+	static char *buf = NULL;
+	static size_t cap = 0;
+
+	int fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	size_t n = 0;
+	while (true) {
+		if (n + 4096 > cap) {
+			size_t ncap = cap ? cap * 2 : 65536;
+			char *tmp = realloc (buf, ncap);
+			if (tmp == NULL) {
+				close (fd);
+				return NULL;
+			}
+			buf = tmp;
+			cap = ncap;
+		}
+		ssize_t rc = read (fd, buf + n, cap - n - 1);
+		if (rc <= 0) {
+			break;
+		}
+		n += rc;
+	}
+	close (fd);
+
+	buf[n] = '\0';
+	*len = n;
+	return buf;
+}
+
+/**
+ * Gets the resident set size of the process in bytes
+ */
+static size_t
+rss_bytes (void)
+{
+	size_t len;
+	const char *statm = proc_read ("/proc/self/statm", &len);
+	unsigned long size, resident;
+	if (statm == NULL || sscanf (statm, "%lu %lu", &size, &resident) != 2) {
+		return 0;
+	}
+	return resident * (size_t)sysconf (_SC_PAGESIZE);
+}
+
+/**
+ * Counts the mappings of the process
+ */
+static size_t
+vma_count (void)
+{
+	size_t len, n = 0;
+	const char *maps = proc_read ("/proc/self/maps", &len);
+	for (size_t i = 0; maps != NULL && i < len; i++) {
+		n += maps[i] == '\n';
+	}
+	return n;
+}
+
+/**
+ * Gets the limit on the number of mappings of a process
+ */
+static size_t
+vma_max (void)
+{
+	size_t len;
+	const char *max = proc_read ("/proc/sys/vm/max_map_count", &len);
+	return max ? strtoul (max, NULL, 10) : 65530;
+}
+
+static uint64_t
+rand_next (uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/**
+ * Times each resume while visiting the coroutines in the given order
+ *
+ * @param  label  result label
+ * @param  list   coroutines
+ * @param  order  index of the coroutine for each step
+ * @param  n      number of coroutines
+ */
+static void
+run_order (const char *label, Strand **list, const size_t *order, size_t n)
+{
+	size_t rounds = n < SAMPLES ? SAMPLES / n : 1;
+	uint64_t *samples = malloc (rounds * n * sizeof (*samples));
+	if (samples == NULL) {
+		return;
+	}
+
+	size_t k = 0;
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < n; i++) {
+			Strand *s = list[order[i]];
+			uint64_t start = bench_now ();
+			strand_resume (s, r);
+			samples[k++] = bench_now () - start;
+		}
+	}
+
+	bench_latency (label, samples, k);
+	free (samples);
+}
+
+/**
+ * Measures a single configuration and count
+ *
+ * @param  cfg  stack configuration
+ * @param  n    number of coroutines
+ */
+static void
+run (const Config *cfg, size_t n)
+{
+	char label[64];
+	size_t page = sysconf (_SC_PAGESIZE);
+
+	// the page holding the coroutine and the top of its stack is resident,
+	// plus room for page tables
+	size_t need = n * page * 5 / 4;
+	size_t avail = (size_t)sysconf (_SC_AVPHYS_PAGES) * page;
+	if (need > avail / 2) {
+		printf ("%s, %zu: skipped, needs about %zu MiB of %zu MiB available\n",
+				cfg->name, n, need >> 20, avail >> 20);
+		return;
+	}
+	if (n * cfg->vmas > vma_max ()) {
+		printf ("%s, %zu: skipped, needs %zu mappings of %zu allowed\n",
+				cfg->name, n, n * cfg->vmas, vma_max ());
+		return;
+	}
+
+	Strand **list = calloc (n, sizeof (*list));
+	size_t *order = calloc (n, sizeof (*order));
+	if (list == NULL || order == NULL) {
+		free (list);
+		free (order);
+		return;
+	}
+
+	size_t rss = rss_bytes ();
+	size_t vmas = vma_count ();
+
+	uint64_t start = bench_now ();
+	for (size_t i = 0; i < n; i++) {
+		list[i] = strand_new_config (cfg->stack_size, cfg->flags, idle, NULL);
+		if (list[i] == NULL) {
+			printf ("%s, %zu: failed after %zu coroutines\n", cfg->name, n, i);
+			exit (1);
+		}
+	}
+	uint64_t ns = bench_now () - start;
+	snprintf (label, sizeof label, "%s, %zu: create", cfg->name, n);
+	bench_report (label, n, ns);
+
+	// the first resume faults in the top of each stack
+	start = bench_now ();
+	for (size_t i = 0; i < n; i++) {
+		order[i] = i;
+		strand_resume (list[i], 0);
+	}
+	ns = bench_now () - start;
+	snprintf (label, sizeof label, "%s, %zu: first resume", cfg->name, n);
+	bench_report (label, n, ns);
+
+	snprintf (label, sizeof label, "%s, %zu: round-robin", cfg->name, n);
+	run_order (label, list, order, n);
+
+	uint64_t seed = 0x9e3779b97f4a7c15;
+	for (size_t i = n - 1; i > 0; i--) {
+		size_t j = rand_next (&seed) % (i + 1);
+		size_t tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	snprintf (label, sizeof label, "%s, %zu: random", cfg->name, n);
+	run_order (label, list, order, n);
+
+	rss = rss_bytes () - rss;
+	vmas = vma_count () - vmas;
+	printf ("%-40s %12zu B/coroutine %12zu mappings\n", "", rss / n, vmas);
+
+	start = bench_now ();
+	for (size_t i = 0; i < n; i++) {
+		strand_free (&list[i]);
+	}
+	ns = bench_now () - start;
+	snprintf (label, sizeof label, "%s, %zu: teardown", cfg->name, n);
+	bench_report (label, n, ns);
+
+	free (list);
+	free (order);
+}
+
+/**
+ * Runs a measurement in a child process so that no mappings are reused
+ */
+static void
+run_fork (const Config *cfg, size_t n)
+{
+	fflush (stdout);
+	pid_t pid = fork ();
+	if (pid == 0) {
+		run (cfg, n);
+		exit (0);
+	}
+	if (pid > 0) {
+		waitpid (pid, NULL, 0);
+	}
+}
+
+int
+main (void)
+{
+	for (size_t c = 0; c < sizeof configs / sizeof configs[0]; c++) {
+		for (size_t i = 0; i < sizeof counts / sizeof counts[0]; i++) {
+			run_fork (&configs[c], counts[i]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include "bench.h"
+
+#include "../src/shard.h"
+#include "../src/park.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define COUNT (UINT64_C(1) << 22)
+#define TABLE (1 << 16)
+#define QUEUE 4096
+#define MAX_THREADS 256
+
+/**
+ * State owned by a key's home shard
+ *
+ * Each request increments a counter in the table of the shard that owns its
+ * key. With shards, only the owner touches its table. With a shared queue,
+ * any thread may apply any request, so the update must be atomic.
+ */
+typedef struct {
+	uint64_t table[TABLE];
+	uint64_t applied __attribute__((aligned (64)));
+	uint64_t expected;
+} Home;
+
+static Home *homes;
+static unsigned nthreads;
+
+static StrandPark park = STRAND_PARK_INIT;
+static unsigned finished = 0;
+
+static bool
+all_finished (void *data)
+{
+	(void)data;
+	return __atomic_load_n (&finished, __ATOMIC_SEQ_CST) == nthreads;
+}
+
+static void
+finish (void)
+{
+	__atomic_add_fetch (&finished, 1, __ATOMIC_SEQ_CST);
+	strand_park_notify (&park, 1);
+}
+
+/**
+ * Spreads the sequential request numbers over the homes
+ */
+static uint64_t
+key_of (uint64_t i)
+{
+	return i * UINT64_C(0x9e3779b97f4a7c15) >> 40;
+}
+
+static void
+apply (void *data)
+{
+	uint64_t key = (uintptr_t)data;
+	Home *h = &homes[key % nthreads];
+	h->table[(key / nthreads) % TABLE]++;
+	if (++h->applied == h->expected) {
+		finish ();
+	}
+}
+
+static void
+generate (void *data)
+{
+	uint64_t i = (uintptr_t)data;
+	uint64_t begin = i * COUNT / nthreads, end = (i + 1) * COUNT / nthreads;
+
+	for (uint64_t n = begin; n < end; n++) {
+		uint64_t key = key_of (n);
+		while (strand_shard_send (key % nthreads, apply, (void *)(uintptr_t)key) == -EAGAIN) {
+			// the owner is busy, so give up the CPU if nothing came back
+			if (strand_shard_poll () == 0) {
+				sched_yield ();
+			}
+		}
+	}
+}
+
+static uint64_t
+run_shards (void)
+{
+	strand_shard_start (nthreads);
+	uint64_t start = bench_now ();
+	for (unsigned i = 0; i < nthreads; i++) {
+		strand_shard_send (i, generate, (void *)(uintptr_t)i);
+	}
+	strand_park_wait (&park, all_finished, NULL);
+	uint64_t ns = bench_now () - start;
+	strand_shard_stop ();
+	return ns;
+}
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t queue[QUEUE];
+static size_t head = 0, tail = 0;
+static uint64_t applied = 0;
+
+static void *
+shared_main (void *data)
+{
+	uint64_t i = (uintptr_t)data;
+	uint64_t n = i * COUNT / nthreads, end = (i + 1) * COUNT / nthreads;
+
+	while (__atomic_load_n (&applied, __ATOMIC_RELAXED) < COUNT) {
+		bool have = false;
+		uint64_t item = 0;
+
+		pthread_mutex_lock (&lock);
+		if (n < end && tail - head < QUEUE) {
+			queue[tail++ % QUEUE] = key_of (n++);
+		}
+		if (head != tail) {
+			item = queue[head++ % QUEUE];
+			have = true;
+		}
+		pthread_mutex_unlock (&lock);
+
+		if (have) {
+			Home *h = &homes[item % nthreads];
+			__atomic_add_fetch (&h->table[(item / nthreads) % TABLE], 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch (&applied, 1, __ATOMIC_RELAXED);
+		}
+		else {
+			sched_yield ();
+		}
+	}
+	return NULL;
+}
+
+static uint64_t
+run_shared (void)
+{
+	pthread_t threads[MAX_THREADS];
+	head = tail = 0;
+	applied = 0;
+
+	uint64_t start = bench_now ();
+	for (unsigned i = 0; i < nthreads; i++) {
+		pthread_create (&threads[i], NULL, shared_main, (void *)(uintptr_t)i);
+	}
+	for (unsigned i = 0; i < nthreads; i++) {
+		pthread_join (threads[i], NULL);
+	}
+	return bench_now () - start;
+}
+
+int
+main (void)
+{
+	long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	unsigned max = cpus > 1 ? (unsigned)cpus : 2;
+	if (max > MAX_THREADS) {
+		max = MAX_THREADS;
+	}
+
+	for (unsigned n = 1; ; n = n * 2 < max ? n * 2 : max) {
+		char name[64];
+		nthreads = n;
+		void *mem;
+		if (posix_memalign (&mem, 64, n * sizeof (*homes)) != 0) {
+			return 1;
+		}
+		homes = mem;
+		memset (homes, 0, n * sizeof (*homes));
+		for (uint64_t i = 0; i < COUNT; i++) {
+			homes[key_of (i) % n].expected++;
+		}
+
+		snprintf (name, sizeof name, "requests: shared queue, %u threads", n);
+		bench_report (name, COUNT, run_shared ());
+
+		for (unsigned i = 0; i < n; i++) {
+			memset (homes[i].table, 0, sizeof (homes[i].table));
+		}
+		__atomic_store_n (&finished, 0, __ATOMIC_SEQ_CST);
+		snprintf (name, sizeof name, "requests: shards, %u threads", n);
+		bench_report (name, COUNT, run_shards ());
+
+		free (homes);
+		if (n == max) {
+			break;
+		}
+	}
+	return 0;
+}
+
@@ -0,0 +1,59 @@
+#include "bench.h"
+
+#include "../src/strand_inline.h"
+
+#define COUNT 10000000
+
+static uintptr_t
+echo (void *data, uintptr_t val)
+{
+	(void)data;
+	while (true) {
+		val = strand_yield (val + 1);
+	}
+	return 0;
+}
+
+static uintptr_t
+echo_inline (void *data, uintptr_t val)
+{
+	(void)data;
+	while (true) {
+		val = strand_yield_inline (val + 1);
+	}
+	return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+	(void)argc;
+	const char *mode = strstr (argv[0], "shared") ? "shared" : "static";
+	char name[64];
+
+	strand_configure (STRAND_STACK_DEFAULT, STRAND_FLAGS_DEFAULT);
+
+	Strand *s = strand_new (echo, NULL);
+	uintptr_t val = 0;
+	uint64_t start = bench_now ();
+	for (int i = 0; i < COUNT; i++) {
+		val = strand_resume (s, val);
+	}
+	snprintf (name, sizeof name, "resume/yield (%s)", mode);
+	bench_report (name, COUNT, bench_now () - start);
+	bench_use (val);
+	strand_free (&s);
+
+	s = strand_new (echo_inline, NULL);
+	val = 0;
+	start = bench_now ();
+	for (int i = 0; i < COUNT; i++) {
+		val = strand_resume_inline (s, val);
+	}
+	snprintf (name, sizeof name, "resume/yield inline (%s)", mode);
+	bench_report (name, COUNT, bench_now () - start);
+	bench_use (val);
+	strand_free (&s);
+
+	return 0;
+}
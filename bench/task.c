@@ -0,0 +1,63 @@
+#include "bench.h"
+
+#include "../src/task.h"
+
+#define COUNT 20000000
+#define ROUNDS 4
+
+typedef struct {
+	StrandTask task;
+	uint32_t beats;
+	uint32_t period;
+} Heartbeat;
+
+static uintptr_t
+heartbeat (StrandTask *t, uintptr_t val)
+{
+	Heartbeat *h = (Heartbeat *)t;
+	STRAND_TASK_BEGIN (t);
+	while (val != 0) {
+		h->beats += h->period;
+		STRAND_TASK_YIELD (t, h->beats);
+	}
+	STRAND_TASK_END (t);
+}
+
+int
+main (void)
+{
+	Heartbeat *list = malloc (COUNT * sizeof (*list));
+	if (list == NULL) {
+		fprintf (stderr, "failed to allocate tasks\n");
+		return 1;
+	}
+
+	uint64_t start = bench_now ();
+	for (size_t i = 0; i < COUNT; i++) {
+		strand_task_init (&list[i].task, heartbeat);
+		list[i].beats = 0;
+		list[i].period = (uint32_t)i % 7 + 1;
+	}
+	bench_report ("task: init", COUNT, bench_now () - start);
+	printf ("%-40s %12zu B/task\n", "", sizeof (*list));
+
+	uintptr_t sum = 0;
+	start = bench_now ();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < COUNT; i++) {
+			sum += strand_task_resume (&list[i].task, 1);
+		}
+	}
+	bench_report ("task: round-robin resume", (uint64_t)COUNT * ROUNDS, bench_now () - start);
+	bench_use (sum);
+
+	start = bench_now ();
+	for (size_t i = 0; i < COUNT; i++) {
+		strand_task_resume (&list[i].task, 0);
+	}
+	bench_report ("task: finish", COUNT, bench_now () - start);
+
+	free (list);
+	return 0;
+}
+
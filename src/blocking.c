@@ -0,0 +1,315 @@
+#include "blocking.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <assert.h>
+#include <errno.h>
+
+#if STRAND_LINUX
+# include <sys/eventfd.h>
+#endif
+
+typedef struct Job Job;
+typedef struct Owner Owner;
+
+/**
+ * A blocking call made from a coroutine
+ *
+ * Jobs live on the stack of the suspended coroutine. `done` is only set by
+ * the owning thread once the job has been taken back from the helpers.
+ */
+struct Job {
+	Job *next;
+	uintptr_t (*fn) (void *);
+	void *arg;
+	uintptr_t result;
+	Strand *strand;
+	Owner *owner;
+	bool done;
+};
+
+/**
+ * Completion queue of a thread that makes blocking calls
+ *
+ * Helpers push completed jobs onto `done` without locking. As the owner
+ * only ever takes the entire list, this is not subject to ABA. The
+ * descriptor is only signaled when the list goes from empty to non-empty.
+ * `pending` counts jobs that helpers have not finished with.
+ */
+struct Owner {
+	Job *done;
+	size_t pending;
+	int fd[2];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static Job *queue = NULL, **queue_tail = &queue;
+static pthread_t *helpers = NULL;
+static unsigned nhelpers = 0;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static __thread Owner *self = NULL;
+
+/**
+ * Releases the completion queue of an exiting thread
+ *
+ * If blocking calls are still outstanding, the queue must outlive the
+ * thread, so it is left allocated.
+ *
+ * @param  data  owner pointer
+ */
+static void
+owner_free (void *data)
+{
+	Owner *o = data;
+	if (__atomic_load_n (&o->pending, __ATOMIC_ACQUIRE) > 0) {
+		return;
+	}
+	close (o->fd[0]);
+	if (o->fd[1] != o->fd[0]) {
+		close (o->fd[1]);
+	}
+	free (o);
+}
+
+static void
+key_create (void)
+{
+	pthread_key_create (&key, owner_free);
+}
+
+/**
+ * Gets or creates the completion queue for the calling thread
+ *
+ * @return  owner or `NULL` on error
+ */
+static Owner *
+owner_get (void)
+{
+	Owner *o = self;
+	if (o != NULL) {
+		return o;
+	}
+
+	o = calloc (1, sizeof (*o));
+	if (o == NULL) {
+		return NULL;
+	}
+
+#if STRAND_LINUX
+	o->fd[0] = o->fd[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (o->fd[0] < 0) {
+#else
+	if (pipe (o->fd) < 0 ||
+			fcntl (o->fd[0], F_SETFL, O_NONBLOCK) < 0 ||
+			fcntl (o->fd[1], F_SETFL, O_NONBLOCK) < 0) {
+#endif
+		int err = errno;
+		free (o);
+		errno = err;
+		return NULL;
+	}
+
+	pthread_once (&once, key_create);
+	pthread_setspecific (key, o);
+	self = o;
+	return o;
+}
+
+/**
+ * Hands a completed job back to its owning thread
+ *
+ * @param  j  completed job
+ */
+static void
+job_complete (Job *j)
+{
+	Owner *o = j->owner;
+	Job *head;
+	do {
+		head = __atomic_load_n (&o->done, __ATOMIC_RELAXED);
+		j->next = head;
+	} while (!__sync_bool_compare_and_swap (&o->done, head, j));
+
+	if (head == NULL) {
+#if STRAND_LINUX
+		uint64_t one = 1;
+		ssize_t rc = write (o->fd[1], &one, sizeof one);
+#else
+		char one = 1;
+		ssize_t rc = write (o->fd[1], &one, sizeof one);
+#endif
+		(void)rc;
+	}
+
+	__sync_fetch_and_sub (&o->pending, 1);
+}
+
+static void *
+helper_main (void *data)
+{
+	(void)data;
+
+	while (true) {
+		pthread_mutex_lock (&lock);
+		while (queue == NULL) {
+			pthread_cond_wait (&wake, &lock);
+		}
+		Job *j = queue;
+		queue = j->next;
+		if (queue == NULL) {
+			queue_tail = &queue;
+		}
+		pthread_mutex_unlock (&lock);
+
+		j->result = j->fn (j->arg);
+		job_complete (j);
+	}
+
+	return NULL;
+}
+
+int
+strand_blocking_start (unsigned n)
+{
+	if (n == 0) {
+		n = STRAND_BLOCKING_DEFAULT;
+	}
+
+	pthread_mutex_lock (&lock);
+
+	int rc = 0;
+	if (helpers != NULL) {
+		rc = -EALREADY;
+		goto out;
+	}
+
+	pthread_t *h = calloc (n, sizeof (*h));
+	if (h == NULL) {
+		rc = -errno;
+		goto out;
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init (&attr);
+	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+	unsigned i;
+	for (i = 0; i < n; i++) {
+		int err = pthread_create (&h[i], &attr, helper_main, NULL);
+		if (err != 0) {
+			rc = -err;
+			break;
+		}
+	}
+	pthread_attr_destroy (&attr);
+
+	// helpers that did start are kept, as they cannot be joined
+	if (i > 0) {
+		helpers = h;
+		nhelpers = i;
+		rc = 0;
+	}
+	else {
+		free (h);
+	}
+
+out:
+	pthread_mutex_unlock (&lock);
+	return rc;
+}
+
+uintptr_t
+strand_blocking (uintptr_t (*fn)(void *), void *arg)
+{
+	assert (fn != NULL);
+
+	Strand *s = strand_current ();
+	if (s == NULL) {
+		return fn (arg);
+	}
+
+	Owner *o = owner_get ();
+	if (o == NULL) {
+		return fn (arg);
+	}
+	if (helpers == NULL) {
+		int rc = strand_blocking_start (0);
+		if (rc < 0 && rc != -EALREADY) {
+			return fn (arg);
+		}
+	}
+
+	Job j = {
+		.fn = fn,
+		.arg = arg,
+		.strand = s,
+		.owner = o,
+	};
+
+	__sync_fetch_and_add (&o->pending, 1);
+
+	pthread_mutex_lock (&lock);
+	*queue_tail = &j;
+	queue_tail = &j.next;
+	pthread_cond_signal (&wake);
+	pthread_mutex_unlock (&lock);
+
+	// the job is on this stack, so resuming early must not return before the
+	// helper is done with it
+	do {
+		strand_yield (STRAND_BLOCKED);
+	} while (!j.done);
+	return j.result;
+}
+
+int
+strand_blocking_fd (void)
+{
+	Owner *o = owner_get ();
+	return o ? o->fd[0] : -errno;
+}
+
+int
+strand_blocking_poll (void)
+{
+	Owner *o = self;
+	if (o == NULL || __atomic_load_n (&o->done, __ATOMIC_RELAXED) == NULL) {
+		return 0;
+	}
+
+	// clear the notification before taking the list so that a completion
+	// arriving in between signals again
+#if STRAND_LINUX
+	uint64_t buf;
+#else
+	char buf[64];
+#endif
+	while (read (o->fd[0], &buf, sizeof buf) > 0) {}
+
+	Job *list = __sync_lock_test_and_set (&o->done, NULL), *fifo = NULL;
+	while (list != NULL) {
+		Job *next = list->next;
+		list->next = fifo;
+		fifo = list;
+		list = next;
+	}
+
+	int n = 0;
+	while (fifo != NULL) {
+		Job *next = fifo->next;
+		// the job is on the coroutine stack, so it may not be used once resumed
+		fifo->done = true;
+		strand_resume (fifo->strand, fifo->result);
+		fifo = next;
+		n++;
+	}
+	return n;
+}
+
@@ -0,0 +1,81 @@
+#ifndef STRAND_BLOCKING_H
+#define STRAND_BLOCKING_H
+
+#include "strand.h"
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+/**
+ * Value received by the parent when a coroutine blocks in `strand_blocking`
+ *
+ * This value is reserved: a parent cannot tell it apart from a coroutine
+ * yielding it directly, so coroutines should not yield it themselves.
+ */
+#define STRAND_BLOCKED UINTPTR_MAX
+
+/**
+ * Starts the helper threads used by `strand_blocking`
+ *
+ * This only needs to be called to control the number of helpers. Otherwise,
+ * the first blocking call starts `STRAND_BLOCKING_DEFAULT` helpers.
+ *
+ * @param  nhelpers  number of helper threads or 0 for the default
+ * @return  0 on success, `-EALREADY` if running, or `-errno` on error
+ */
+extern int
+strand_blocking_start (unsigned nhelpers);
+
+/**
+ * Default number of helper threads
+ */
+#define STRAND_BLOCKING_DEFAULT 4
+
+/**
+ * Runs a blocking function on a helper thread
+ *
+ * The current coroutine is suspended and `STRAND_BLOCKED` is returned to its
+ * parent, so other coroutines on the thread keep running while `fn` blocks.
+ * Once `fn` returns, the coroutine is resumed with the result by the next
+ * call to `strand_blocking_poll` on the thread that called this. Resuming
+ * the coroutine before then yields `STRAND_BLOCKED` again.
+ *
+ * When called outside of a coroutine, `fn` is invoked directly.
+ *
+ * @param  fn   function to invoke on a helper thread
+ * @param  arg  argument to pass to `fn`
+ * @return  value returned by `fn`
+ */
+extern uintptr_t
+strand_blocking (uintptr_t (*fn)(void *), void *arg);
+
+/**
+ * Gets the completion descriptor for the calling thread
+ *
+ * The descriptor becomes readable when blocking calls made from this
+ * thread have completed, and may be added to an event loop. A single
+ * notification is sent for any number of completions that arrive before
+ * the next `strand_blocking_poll`.
+ *
+ * @return  file descriptor or `-errno` on error
+ */
+extern int
+strand_blocking_fd (void);
+
+/**
+ * Resumes coroutines of the calling thread whose blocking calls completed
+ *
+ * This never blocks. Coroutines are resumed in completion order.
+ *
+ * @return  number of coroutines resumed
+ */
+extern int
+strand_blocking_poll (void);
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
@@ -39,6 +39,14 @@ strand_ctx_init (uintptr_t *ctx, void *stack, size_t len,
 static size_t
 strand_ctx_stack_size (const uintptr_t *ctx, void *stack, size_t len, bool current);
 
+/**
+ * Prefetches the state that a switch into a suspended context loads
+ *
+ * @param  ctx  context pointer of a suspended coroutine
+ */
+static inline void
+strand_ctx_prefetch (const uintptr_t *ctx);
+
 /**
  * Prints the value of the context
  *
@@ -57,6 +65,11 @@ strand_ctx_print (const uintptr_t *ctx, FILE *out);
 void
 strand_ctx_swap (uintptr_t *save, const uintptr_t *load);
 
+/*
+ * `strand_ctx_switch` is the exported name of the same code. It is used by
+ * "strand_inline.h", while calls within the library use the local name.
+ */
+
 #if STRAND_X86_64
 # include "ctx/x86_64.c"
 #elif STRAND_X86_32
@@ -1,12 +1,24 @@
-#define STRAND_CTX_REG_COUNT 7
+/*
+ * Only the stack pointer is stored in the context. The callee-saved
+ * registers and the return address are pushed onto the stack of the
+ * suspended context, which keeps the context within the first cache line
+ * of the coroutine. The return address is popped and jumped to rather than
+ * returned to, as a `ret` to a different call site than the one that
+ * entered would always be mispredicted.
+ */
+#define STRAND_CTX_REG_COUNT 1
+
+#define ESP 0
 
-#define EBX 0
+/**
+ * Layout of the registers saved on a suspended stack
+ */
+#define EDI 0
 #define ESI 1
-#define EDI 2
+#define EBX 2
 #define EBP 3
 #define EIP 4
-#define ESP 5
-#define ECX 6
+#define FRAME_COUNT 5
 
 /**
  * Gets a pointer to the starting address of the stack
@@ -32,8 +44,16 @@ strand_ctx_init (uintptr_t *ctx, void *stack, size_t len,
 
 	s[1] = a1;
 	s[2] = a2;
-	ctx[EIP] = ip;
-	ctx[ESP] = (uintptr_t)s;
+
+	// the saved return address enters the function directly, with the
+	// arguments already in place above the fake return address
+	uintptr_t *f = s - FRAME_COUNT;
+	f[EDI] = 0;
+	f[ESI] = 0;
+	f[EBX] = 0;
+	f[EBP] = 0;
+	f[EIP] = ip;
+	ctx[ESP] = (uintptr_t)f;
 }
 
 size_t
@@ -50,46 +70,54 @@ strand_ctx_stack_size (const uintptr_t *ctx, void *stack, size_t len, bool curre
 	return (uintptr_t)s - sp;
 }
 
+void
+strand_ctx_prefetch (const uintptr_t *ctx)
+{
+	// the saved frame may straddle two cache lines
+	const uint8_t *f = (const uint8_t *)ctx[ESP];
+	__builtin_prefetch (f, 1);
+	__builtin_prefetch (f + FRAME_COUNT * sizeof (uintptr_t) - 1, 1);
+}
+
 void
 strand_ctx_print (const uintptr_t *ctx, FILE *out)
 {
+	const uintptr_t *f = (const uintptr_t *)ctx[ESP];
 	fprintf (out,
 		"\tebx: 0x%08" PRIxPTR "\n"
 		"\tesi: 0x%08" PRIxPTR "\n"
 		"\tedi: 0x%08" PRIxPTR "\n"
 		"\tebp: 0x%08" PRIxPTR "\n"
 		"\teip: 0x%08" PRIxPTR "\n"
-		"\tesp: 0x%08" PRIxPTR "\n"
-		"\tecx: 0x%08" PRIxPTR "\n",
-		ctx[EBX], ctx[ESI], ctx[EDI], ctx[EBP], ctx[EIP], ctx[ESP], ctx[ECX]);
+		"\tesp: 0x%08" PRIxPTR "\n",
+		f[EBX], f[ESI], f[EDI], f[EBP], f[EIP], ctx[ESP]);
 }
 
 __asm__ (
 	".text\n"
 #if defined (__APPLE__)
-	"_strand_ctx_swap:\n"
+	".globl _strand_ctx_switch\n"
+	"_strand_ctx_switch:\n"
+	"_strand_ctx_swap:\n\t"
 #else
+	".globl strand_ctx_switch\n"
+	".type strand_ctx_switch, @function\n"
+	"strand_ctx_switch:\n"
 	"strand_ctx_swap:\n\t"
 #endif
 		"movl    4(%esp),     %eax  \n\t"
-		"movl      %ecx,   24(%eax) \n\t"
-		"movl      %ebx,    0(%eax) \n\t"
-		"movl      %esi,    4(%eax) \n\t"
-		"movl      %edi,    8(%eax) \n\t"
-		"movl      %ebp,   12(%eax) \n\t"
-		"movl     (%esp),     %ecx  \n\t"
-		"movl      %ecx,   16(%eax) \n\t"
-		"leal    4(%esp),     %ecx  \n\t"
-		"movl      %ecx,   20(%eax) \n\t"
-		"movl    8(%esp),     %eax  \n\t"
-		"movl   16(%eax),     %ecx  \n\t"
-		"movl   20(%eax),     %esp  \n\t"
-		"pushl     %ecx             \n\t"
-		"movl    0(%eax),     %ebx  \n\t"
-		"movl    4(%eax),     %esi  \n\t"
-		"movl    8(%eax),     %edi  \n\t"
-		"movl   12(%eax),     %ebp  \n\t"
-		"movl   24(%eax),     %ecx  \n\t"
-		"ret                        \n\t"
+		"movl    8(%esp),     %edx  \n\t"
+		"pushl     %ebp             \n\t"
+		"pushl     %ebx             \n\t"
+		"pushl     %esi             \n\t"
+		"pushl     %edi             \n\t"
+		"movl      %esp,     (%eax) \n\t"
+		"movl     (%edx),     %esp  \n\t"
+		"popl      %edi             \n\t"
+		"popl      %esi             \n\t"
+		"popl      %ebx             \n\t"
+		"popl      %ebp             \n\t"
+		"popl      %ecx             \n\t"
+		"jmp      *%ecx             \n\t"
 );
 
@@ -1,15 +1,26 @@
-#define STRAND_CTX_REG_COUNT 10
+/*
+ * Only the stack pointer is stored in the context. The callee-saved
+ * registers and the return address are pushed onto the stack of the
+ * suspended context, which keeps the context within the first cache line
+ * of the coroutine. The return address is popped and jumped to rather than
+ * returned to, as a `ret` to a different call site than the one that
+ * entered would always be mispredicted.
+ */
+#define STRAND_CTX_REG_COUNT 1
+
+#define RSP 0
 
-#define RBX 0
-#define RBP 1
-#define R12 2
-#define R13 3
-#define R14 4
-#define R15 5
-#define RDI 6
-#define RSI 7
-#define RIP 8
-#define RSP 9
+/**
+ * Layout of the registers saved on a suspended stack
+ */
+#define R15 0
+#define R14 1
+#define R13 2
+#define R12 3
+#define RBX 4
+#define RBP 5
+#define RIP 6
+#define FRAME_COUNT 7
 
 /**
  * Gets a pointer to the starting address of the stack
@@ -26,6 +37,14 @@ strand_stack_start (uint8_t *stack, size_t len)
 	return s - 1;
 }
 
+/**
+ * Moves the arguments into place and jumps to the entry function
+ *
+ * This is the first return target of a new context.
+ */
+void
+strand_ctx_start (void);
+
 void
 strand_ctx_init (uintptr_t *ctx, void *stack, size_t len,
 		uintptr_t ip, uintptr_t a1, uintptr_t a2)
@@ -33,10 +52,15 @@ strand_ctx_init (uintptr_t *ctx, void *stack, size_t len,
 	uintptr_t *s = strand_stack_start (stack, len);
 	*s = 0;
 
-	ctx[RDI] = a1;
-	ctx[RSI] = a2;
-	ctx[RIP] = ip;
-	ctx[RSP] = (uintptr_t)s;
+	uintptr_t *f = s - FRAME_COUNT;
+	f[R15] = 0;
+	f[R14] = 0;
+	f[R13] = a2;
+	f[R12] = a1;
+	f[RBX] = ip;
+	f[RBP] = 0;
+	f[RIP] = (uintptr_t)strand_ctx_start;
+	ctx[RSP] = (uintptr_t)f;
 }
 
 size_t
@@ -53,9 +77,19 @@ strand_ctx_stack_size (const uintptr_t *ctx, void *stack, size_t len, bool curre
 	return (uintptr_t)s - sp;
 }
 
+void
+strand_ctx_prefetch (const uintptr_t *ctx)
+{
+	// the saved frame may straddle two cache lines
+	const uint8_t *f = (const uint8_t *)ctx[RSP];
+	__builtin_prefetch (f, 1);
+	__builtin_prefetch (f + FRAME_COUNT * sizeof (uintptr_t) - 1, 1);
+}
+
 void
 strand_ctx_print (const uintptr_t *ctx, FILE *out)
 {
+	const uintptr_t *f = (const uintptr_t *)ctx[RSP];
 	fprintf (out,
 		"\trbx: 0x%016" PRIxPTR "\n"
 		"\trbp: 0x%016" PRIxPTR "\n"
@@ -63,43 +97,47 @@ strand_ctx_print (const uintptr_t *ctx, FILE *out)
 		"\tr13: 0x%016" PRIxPTR "\n"
 		"\tr14: 0x%016" PRIxPTR "\n"
 		"\tr15: 0x%016" PRIxPTR "\n"
-		"\trdi: 0x%016" PRIxPTR "\n"
-		"\trsi: 0x%016" PRIxPTR "\n"
 		"\trip: 0x%016" PRIxPTR "\n"
 		"\trsp: 0x%016" PRIxPTR "\n",
-		ctx[RBX], ctx[RBP], ctx[R12], ctx[R13], ctx[R14],
-		ctx[R15], ctx[RDI], ctx[RSI], ctx[RIP], ctx[RSP]);
+		f[RBX], f[RBP], f[R12], f[R13], f[R14],
+		f[R15], f[RIP], ctx[RSP]);
 }
 
 __asm__ (
 	".text                          \n"
 #if defined (__APPLE__)
+	".globl _strand_ctx_switch      \n"
+	"_strand_ctx_switch:            \n"
 	"_strand_ctx_swap:              \n\t"
 #else
+	".globl strand_ctx_switch       \n"
+	".type strand_ctx_switch, @function \n"
+	"strand_ctx_switch:             \n"
 	"strand_ctx_swap:               \n\t"
 #endif
-		"movq      %rbx,    0(%rdi) \n\t"
-		"movq      %rbp,    8(%rdi) \n\t"
-		"movq      %r12,   16(%rdi) \n\t"
-		"movq      %r13,   24(%rdi) \n\t"
-		"movq      %r14,   32(%rdi) \n\t"
-		"movq      %r15,   40(%rdi) \n\t"
-		"movq      %rdi,   48(%rdi) \n\t"
-		"movq      %rsi,   56(%rdi) \n\t"
-		"movq     (%rsp),     %rcx  \n\t"
-		"movq      %rcx,   64(%rdi) \n\t"
-		"leaq    8(%rsp),     %rcx  \n\t"
-		"movq      %rcx,   72(%rdi) \n\t"
-		"movq   72(%rsi),     %rsp  \n\t"
-		"movq    0(%rsi),     %rbx  \n\t"
-		"movq    8(%rsi),     %rbp  \n\t"
-		"movq   16(%rsi),     %r12  \n\t"
-		"movq   24(%rsi),     %r13  \n\t"
-		"movq   32(%rsi),     %r14  \n\t"
-		"movq   40(%rsi),     %r15  \n\t"
-		"movq   48(%rsi),     %rdi  \n\t"
-		"movq   64(%rsi),     %rcx  \n\t"
-		"movq   56(%rsi),     %rsi  \n\t"
-		"jmp      *%rcx             \n\t"
+		"pushq     %rbp             \n\t"
+		"pushq     %rbx             \n\t"
+		"pushq     %r12             \n\t"
+		"pushq     %r13             \n\t"
+		"pushq     %r14             \n\t"
+		"pushq     %r15             \n\t"
+		"movq      %rsp,     (%rdi) \n\t"
+		"movq     (%rsi),     %rsp  \n\t"
+		"popq      %r15             \n\t"
+		"popq      %r14             \n\t"
+		"popq      %r13             \n\t"
+		"popq      %r12             \n\t"
+		"popq      %rbx             \n\t"
+		"popq      %rbp             \n\t"
+		"popq      %rcx             \n\t"
+		"jmp      *%rcx             \n"
+#if defined (__APPLE__)
+	"_strand_ctx_start:             \n\t"
+#else
+	"strand_ctx_start:              \n\t"
+#endif
+		"movq      %r12,      %rdi  \n\t"
+		"movq      %r13,      %rsi  \n\t"
+		"jmp      *%rbx             \n\t"
 );
 
@@ -0,0 +1,322 @@
+#include "future.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include <errno.h>
+
+/**
+ * Number of futures allocated at a time for a thread's slab
+ */
+#ifndef STRAND_FUTURE_SLAB
+# define STRAND_FUTURE_SLAB 64
+#endif
+
+typedef struct Waiter Waiter;
+typedef struct Link Link;
+
+/**
+ * A coroutine suspended in one of the await calls
+ *
+ * Waiters and links live on the stack of the suspended coroutine. A waiter
+ * is only resumed once, when the first of its futures completes.
+ */
+struct Waiter {
+	Waiter *next;
+	Strand *strand;
+	size_t index;
+	bool fired;
+};
+
+/**
+ * Entry for a waiter in the list of a future
+ *
+ * `prev` is cleared once the future has taken its list, so the waiter knows
+ * not to unlink it.
+ */
+struct Link {
+	Link *next, **prev;
+	Waiter *waiter;
+	size_t index;
+};
+
+struct StrandFuture {
+	Link *waiters, **tail;
+	StrandFuture *next_free;
+	uintptr_t value;
+	bool done;
+};
+
+static __thread StrandFuture *slab = NULL;
+static __thread bool slab_owned = false;
+
+/**
+ * Free futures handed back by exited threads
+ */
+static pthread_mutex_t orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+static StrandFuture *orphans = NULL;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+/**
+ * Hands the free futures of an exiting thread to the shared list
+ *
+ * @param  data  unused key value
+ */
+static void
+slab_release (void *data)
+{
+	(void)data;
+
+	StrandFuture *list = slab;
+	slab = NULL;
+	if (list == NULL) {
+		return;
+	}
+
+	StrandFuture *last = list;
+	while (last->next_free != NULL) {
+		last = last->next_free;
+	}
+
+	pthread_mutex_lock (&orphans_lock);
+	last->next_free = orphans;
+	orphans = list;
+	pthread_mutex_unlock (&orphans_lock);
+}
+
+static void
+key_create (void)
+{
+	pthread_key_create (&key, slab_release);
+}
+
+/**
+ * Refills the thread's slab from the shared list or a new chunk
+ *
+ * @return  `true` if any futures were added
+ */
+static bool
+slab_refill (void)
+{
+	if (!slab_owned) {
+		pthread_once (&once, key_create);
+		pthread_setspecific (key, &slab_owned);
+		slab_owned = true;
+	}
+
+	if (__atomic_load_n (&orphans, __ATOMIC_RELAXED) != NULL) {
+		pthread_mutex_lock (&orphans_lock);
+		slab = orphans;
+		orphans = NULL;
+		pthread_mutex_unlock (&orphans_lock);
+		if (slab != NULL) {
+			return true;
+		}
+	}
+
+	StrandFuture *chunk = malloc (STRAND_FUTURE_SLAB * sizeof (*chunk));
+	if (chunk == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < STRAND_FUTURE_SLAB; i++) {
+		chunk[i].next_free = i + 1 < STRAND_FUTURE_SLAB ? &chunk[i + 1] : NULL;
+	}
+	slab = chunk;
+	return true;
+}
+
+/**
+ * Adds a waiter to the end of the list of a future
+ *
+ * @param  f  incomplete future
+ * @param  l  link to add
+ */
+#if defined (__GNUC__) && !defined (__clang__) && __GNUC__ >= 12
+// the link lives on the stack of the waiting coroutine, but it is always
+// unlinked, or taken by completion, before that frame returns
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wdangling-pointer"
+#endif
+static void
+link_add (StrandFuture *f, Link *l)
+{
+	l->next = NULL;
+	l->prev = f->tail;
+	*f->tail = l;
+	f->tail = &l->next;
+}
+#if defined (__GNUC__) && !defined (__clang__) && __GNUC__ >= 12
+# pragma GCC diagnostic pop
+#endif
+
+/**
+ * Removes a waiter from the list of a future unless it was already taken
+ *
+ * @param  f  future
+ * @param  l  link to remove
+ */
+static void
+link_remove (StrandFuture *f, Link *l)
+{
+	if (l->prev == NULL) {
+		return;
+	}
+	*l->prev = l->next;
+	if (l->next != NULL) {
+		l->next->prev = l->prev;
+	}
+	else {
+		f->tail = l->prev;
+	}
+}
+
+/**
+ * Yields until one of the futures of a waiter has completed
+ *
+ * @param  w  waiter of the current coroutine
+ */
+static void
+waiter_suspend (Waiter *w)
+{
+	assert (w->strand != NULL);
+
+	while (!w->fired) {
+		strand_yield (STRAND_AWAITING);
+	}
+}
+
+StrandFuture *
+strand_future_new (void)
+{
+	if (slab == NULL && !slab_refill ()) {
+		return NULL;
+	}
+
+	StrandFuture *f = slab;
+	slab = f->next_free;
+
+	f->waiters = NULL;
+	f->tail = &f->waiters;
+	f->value = 0;
+	f->done = false;
+	return f;
+}
+
+void
+strand_future_free (StrandFuture **fp)
+{
+	assert (fp != NULL);
+
+	StrandFuture *f = *fp;
+	if (f == NULL) {
+		return;
+	}
+	*fp = NULL;
+
+	assert (f->done || f->waiters == NULL);
+
+	f->next_free = slab;
+	slab = f;
+}
+
+int
+strand_future_complete (StrandFuture *f, uintptr_t value)
+{
+	assert (f != NULL);
+
+	if (f->done) {
+		return -EALREADY;
+	}
+	f->value = value;
+	f->done = true;
+
+	// collect the waiters before resuming any, as a resumed coroutine may
+	// unlink itself from other futures or complete them
+	Waiter *ready = NULL, **tail = &ready;
+	for (Link *l = f->waiters; l != NULL; l = l->next) {
+		l->prev = NULL;
+		Waiter *w = l->waiter;
+		if (!w->fired) {
+			w->fired = true;
+			w->index = l->index;
+			w->next = NULL;
+			*tail = w;
+			tail = &w->next;
+		}
+	}
+	f->waiters = NULL;
+	f->tail = &f->waiters;
+
+	while (ready != NULL) {
+		Waiter *next = ready->next;
+		strand_resume (ready->strand, value);
+		ready = next;
+	}
+	return 0;
+}
+
+bool
+strand_future_done (const StrandFuture *f)
+{
+	assert (f != NULL);
+
+	return f->done;
+}
+
+uintptr_t
+strand_future_await (StrandFuture *f)
+{
+	assert (f != NULL);
+
+	if (!f->done) {
+		Waiter w = { .strand = strand_current () };
+		Link l = { .waiter = &w };
+		link_add (f, &l);
+		waiter_suspend (&w);
+		link_remove (f, &l);
+	}
+	return f->value;
+}
+
+void
+strand_future_await_all (StrandFuture **list, size_t n)
+{
+	assert (list != NULL || n == 0);
+
+	for (size_t i = 0; i < n; i++) {
+		strand_future_await (list[i]);
+	}
+}
+
+size_t
+strand_future_await_any (StrandFuture **list, size_t n)
+{
+	assert (list != NULL);
+	assert (n > 0);
+
+	for (size_t i = 0; i < n; i++) {
+		if (list[i]->done) {
+			return i;
+		}
+	}
+	if (n > STRAND_FUTURE_ANY_MAX) {
+		return n;
+	}
+
+	Waiter w = { .strand = strand_current () };
+	Link links[n];
+	for (size_t i = 0; i < n; i++) {
+		links[i] = (Link) { .waiter = &w, .index = i };
+		link_add (list[i], &links[i]);
+	}
+
+	waiter_suspend (&w);
+
+	for (size_t i = 0; i < n; i++) {
+		link_remove (list[i], &links[i]);
+	}
+	return w.index;
+}
+
@@ -0,0 +1,118 @@
+#ifndef STRAND_FUTURE_H
+#define STRAND_FUTURE_H
+
+#include "strand.h"
+
+#include <stddef.h>
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+/**
+ * Value received by the parent when a coroutine suspends to await a future
+ */
+#define STRAND_AWAITING (UINTPTR_MAX - 1)
+
+/**
+ * A value that is completed once and awaited by coroutines
+ *
+ * Futures are used by the coroutines of a single thread. Any coroutine, or
+ * the thread outside of a coroutine, may complete a future, and completing
+ * it resumes each waiting coroutine directly in the order they started
+ * waiting. Future objects are allocated from a per-thread slab, and the
+ * memory is kept for reuse rather than returned to the system.
+ */
+typedef struct StrandFuture StrandFuture;
+
+/**
+ * Creates an incomplete future
+ *
+ * @return  future or `NULL` on error
+ */
+extern StrandFuture *
+strand_future_new (void);
+
+/**
+ * Releases a future
+ *
+ * No coroutine may be waiting on it.
+ *
+ * @param  fp  reference to the future pointer
+ */
+extern void
+strand_future_free (StrandFuture **fp);
+
+/**
+ * Completes a future and resumes its waiters
+ *
+ * Each waiting coroutine is resumed with `value` before this returns.
+ *
+ * @param  f      future to complete
+ * @param  value  result of the future
+ * @return  0 on success or `-EALREADY` if already complete
+ */
+extern int
+strand_future_complete (StrandFuture *f, uintptr_t value);
+
+/**
+ * Checks if a future has been completed
+ *
+ * @param  f  future
+ * @return  `true` if complete
+ */
+extern bool
+strand_future_done (const StrandFuture *f);
+
+/**
+ * Suspends the current coroutine until a future is complete
+ *
+ * If the future is not complete yet, `STRAND_AWAITING` is yielded to the
+ * parent. This must be called from a coroutine unless the future is
+ * already complete.
+ *
+ * @param  f  future to wait on
+ * @return  value of the future
+ */
+extern uintptr_t
+strand_future_await (StrandFuture *f);
+
+/**
+ * Suspends the current coroutine until every future in a list is complete
+ *
+ * @param  list  futures to wait on
+ * @param  n     number of futures
+ */
+extern void
+strand_future_await_all (StrandFuture **list, size_t n);
+
+/**
+ * Maximum number of futures passed to `strand_future_await_any`
+ *
+ * A link for each future is kept on the stack of the waiting coroutine.
+ */
+#ifndef STRAND_FUTURE_ANY_MAX
+# define STRAND_FUTURE_ANY_MAX 32
+#endif
+
+/**
+ * Suspends the current coroutine until any future in a list is complete
+ *
+ * A list longer than `STRAND_FUTURE_ANY_MAX` is only checked for a complete
+ * future. If there is none, `n` is returned rather than waiting.
+ *
+ * @param  list  futures to wait on
+ * @param  n     number of futures, at least 1
+ * @return  index of the first complete future in the list, or of the first
+ *          to complete if none were complete when called, or `n` without
+ *          waiting if `n` is above the maximum
+ */
+extern size_t
+strand_future_await_any (StrandFuture **list, size_t n);
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
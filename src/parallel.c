@@ -0,0 +1,513 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "parallel.h"
+#include "park.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <assert.h>
+#include <errno.h>
+
+#if STRAND_LINUX
+# include <sched.h>
+#endif
+
+/**
+ * Maximum number of sub-ranges forked by a single task
+ *
+ * Each task halves its range at most this many times. As the range size is
+ * a `size_t`, this is enough to reach any grain size.
+ */
+#define FORK_MAX (sizeof (size_t) * 8)
+
+typedef struct Task Task;
+typedef struct Join Join;
+typedef struct Worker Worker;
+
+/**
+ * Tracks the completion of a set of forked tasks
+ *
+ * The count starts with a reference for each forked task plus one for the
+ * waiter. The waiter reference is only released once the waiting coroutine
+ * has been fully suspended, so whichever release brings the count to zero
+ * is guaranteed to be able to reschedule the waiter.
+ */
+struct Join {
+	size_t count;
+	Task *waiter;
+	int done;
+};
+
+/**
+ * A schedulable unit of work
+ *
+ * A task starts without a coroutine. The coroutine is created by the first
+ * worker to run it, and the task is requeued with that coroutine each time
+ * it is ready to continue after a join.
+ */
+struct Task {
+	Task *next, *prev;
+	Strand *strand;
+	void (*fn) (void *, size_t, size_t);
+	void *data;
+	size_t begin, end, grain;
+	Join *join;
+};
+
+struct Worker {
+	pthread_mutex_t lock;
+	Task queue;
+	pthread_t thread;
+	unsigned index;
+	int cpu;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static StrandPark park = STRAND_PARK_INIT;
+static Worker *workers = NULL;
+static unsigned nworkers = 0, next = 0;
+
+/**
+ * Number of queued tasks and the stop request
+ *
+ * These are read by idle workers without locking, so they are only
+ * accessed atomically.
+ */
+static size_t pending = 0;
+static bool stopping = false;
+
+static __thread Worker *self = NULL;
+static __thread Task *running = NULL;
+
+/**
+ * Adds a task to a worker queue and wakes an idle worker
+ *
+ * Tasks pushed from a worker thread go to that worker's queue. Tasks from
+ * other threads are distributed round-robin.
+ *
+ * @param  t  task to schedule
+ */
+static void
+task_push (Task *t)
+{
+	Worker *w = self;
+	if (w == NULL) {
+		w = &workers[__sync_fetch_and_add (&next, 1) % nworkers];
+	}
+
+	pthread_mutex_lock (&w->lock);
+	t->next = w->queue.next;
+	t->prev = &w->queue;
+	t->next->prev = t;
+	w->queue.next = t;
+	pthread_mutex_unlock (&w->lock);
+
+	__atomic_add_fetch (&pending, 1, __ATOMIC_SEQ_CST);
+	strand_park_notify (&park, 1);
+}
+
+/**
+ * Removes a task from a worker queue
+ *
+ * The owning worker takes the most recently pushed task to keep its working
+ * set small, while thieves take the oldest task as it is likely to be the
+ * largest remaining range.
+ *
+ * @param  w     worker to take from
+ * @param  mine  if the calling thread owns `w`
+ * @return  task or `NULL` if the queue is empty
+ */
+static Task *
+task_take (Worker *w, bool mine)
+{
+	pthread_mutex_lock (&w->lock);
+	Task *t = mine ? w->queue.next : w->queue.prev;
+	if (t == &w->queue) {
+		t = NULL;
+	}
+	else {
+		t->prev->next = t->next;
+		t->next->prev = t->prev;
+	}
+	pthread_mutex_unlock (&w->lock);
+	return t;
+}
+
+/**
+ * Tests if an idle worker has anything to do
+ *
+ * @param  data  unused
+ * @return  `true` if a task is queued or the pool is stopping
+ */
+static bool
+work_ready (void *data)
+{
+	(void)data;
+	return __atomic_load_n (&pending, __ATOMIC_SEQ_CST) > 0 ||
+		__atomic_load_n (&stopping, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Waits for the next task for the current worker
+ *
+ * @return  task or `NULL` if the pool is stopping
+ */
+static Task *
+task_next (void)
+{
+	Worker *w = self;
+
+	while (true) {
+		Task *t = task_take (w, true);
+		for (unsigned i = 1; t == NULL && i < nworkers; i++) {
+			t = task_take (&workers[(w->index + i) % nworkers], false);
+		}
+
+		if (t != NULL) {
+			__atomic_sub_fetch (&pending, 1, __ATOMIC_SEQ_CST);
+			return t;
+		}
+		if (__atomic_load_n (&stopping, __ATOMIC_SEQ_CST) &&
+				__atomic_load_n (&pending, __ATOMIC_SEQ_CST) == 0) {
+			return NULL;
+		}
+		strand_park_wait (&park, work_ready, NULL);
+	}
+}
+
+/**
+ * Releases a reference to a join
+ *
+ * @param  j  join to release
+ */
+static void
+join_release (Join *j)
+{
+	if (__sync_sub_and_fetch (&j->count, 1) > 0) {
+		return;
+	}
+
+	if (j->waiter != NULL) {
+		task_push (j->waiter);
+	}
+	else {
+		pthread_mutex_lock (&lock);
+		j->done = 1;
+		pthread_cond_broadcast (&done);
+		pthread_mutex_unlock (&lock);
+	}
+}
+
+/**
+ * Processes a range on the calling thread in pieces that fit the grain
+ *
+ * @param  begin  first index of the range
+ * @param  end    index after the last in the range
+ * @param  grain  maximum size of a processed range
+ * @param  fn     function to process a range
+ * @param  data   user data pointer
+ */
+static void
+range_run (size_t begin, size_t end, size_t grain,
+		void (*fn)(void *, size_t, size_t), void *data)
+{
+	while (end - begin > grain) {
+		fn (data, begin, begin + grain);
+		begin += grain;
+	}
+	fn (data, begin, end);
+}
+
+/**
+ * Splits a range into forked tasks and processes the remainder
+ *
+ * The upper half of the range is repeatedly forked off until the lower half
+ * fits within the grain, which is then processed directly. If anything was
+ * forked, the coroutine yields the join to the worker and is resumed once
+ * all forked tasks have completed.
+ *
+ * @param  waiter  task of the calling coroutine
+ * @param  begin   first index of the range
+ * @param  end     index after the last in the range
+ * @param  grain   maximum size of a processed range
+ * @param  fn      function to process a range
+ * @param  data    user data pointer
+ */
+static void
+fork_join (Task *waiter, size_t begin, size_t end, size_t grain,
+		void (*fn)(void *, size_t, size_t), void *data)
+{
+	Task forks[FORK_MAX];
+	size_t n = 0;
+
+	while (end - begin > grain && n < FORK_MAX) {
+		size_t mid = begin + (end - begin) / 2;
+		forks[n++] = (Task) {
+			.fn = fn, .data = data,
+			.begin = mid, .end = end, .grain = grain
+		};
+		end = mid;
+	}
+
+	Join join = { .count = n + 1, .waiter = waiter };
+	for (size_t i = 0; i < n; i++) {
+		forks[i].join = &join;
+		task_push (&forks[i]);
+	}
+
+	fn (data, begin, end);
+
+	if (n > 0) {
+		strand_yield ((uintptr_t)&join);
+	}
+}
+
+/**
+ * Coroutine body for a task
+ *
+ * @param  data  task pointer
+ * @param  val   unused
+ * @return  0 to indicate completion
+ */
+static uintptr_t
+task_main (void *data, uintptr_t val)
+{
+	(void)val;
+
+	Task *t = data;
+	fork_join (t, t->begin, t->end, t->grain, t->fn, t->data);
+	return 0;
+}
+
+/**
+ * Runs a task until it completes or waits on a join
+ *
+ * @param  t  task to run
+ */
+static void
+task_run (Task *t)
+{
+	if (t->strand == NULL) {
+		t->strand = strand_new (task_main, t);
+		if (t->strand == NULL) {
+			// without a coroutine the task cannot be suspended, so nested
+			// ranges will be processed serially
+			range_run (t->begin, t->end, t->grain, t->fn, t->data);
+			join_release (t->join);
+			return;
+		}
+	}
+
+	running = t;
+	uintptr_t val = strand_resume (t->strand, 0);
+	running = NULL;
+
+	if (strand_alive (t->strand)) {
+		// the coroutine is now suspended, so the waiter reference may be
+		// released without racing the forked tasks
+		join_release ((Join *)val);
+	}
+	else {
+		strand_free (&t->strand);
+		join_release (t->join);
+	}
+}
+
+static void *
+worker_main (void *data)
+{
+	self = data;
+
+	if (self->cpu >= 0) {
+		strand_pin (self->cpu);
+	}
+
+	Task *t;
+	while ((t = task_next ()) != NULL) {
+		task_run (t);
+	}
+
+	return NULL;
+}
+
+/**
+ * Assigns a CPU to each worker from the CPUs available to the process
+ *
+ * @param  w  worker array
+ * @param  n  number of workers
+ */
+static void
+worker_pin (Worker *w, unsigned n)
+{
+#if STRAND_LINUX
+	cpu_set_t set;
+	if (sched_getaffinity (0, sizeof set, &set) == 0 && CPU_COUNT (&set) > 0) {
+		int cpu = 0;
+		for (unsigned i = 0; i < n; i++) {
+			while (!CPU_ISSET (cpu, &set)) {
+				cpu = (cpu + 1) % CPU_SETSIZE;
+			}
+			w[i].cpu = cpu;
+			cpu = (cpu + 1) % CPU_SETSIZE;
+		}
+	}
+#else
+	(void)w;
+	(void)n;
+#endif
+}
+
+int
+strand_parallel_start (unsigned n)
+{
+	return strand_parallel_start_config (n, 0);
+}
+
+int
+strand_parallel_start_config (unsigned n, uint32_t flags)
+{
+	if (n == 0) {
+		long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? (unsigned)cpus : 1;
+	}
+
+	pthread_mutex_lock (&lock);
+
+	int rc = 0;
+	if (workers != NULL) {
+		rc = -EALREADY;
+		goto out;
+	}
+
+	Worker *w = calloc (n, sizeof (*w));
+	if (w == NULL) {
+		rc = -errno;
+		goto out;
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		pthread_mutex_init (&w[i].lock, NULL);
+		w[i].queue.next = w[i].queue.prev = &w[i].queue;
+		w[i].index = i;
+		w[i].cpu = -1;
+	}
+
+	if (flags & STRAND_PARALLEL_FPIN) {
+		worker_pin (w, n);
+	}
+
+	workers = w;
+	nworkers = n;
+	__atomic_store_n (&stopping, false, __ATOMIC_SEQ_CST);
+
+	for (unsigned i = 0; i < n; i++) {
+		int err = pthread_create (&w[i].thread, NULL, worker_main, &w[i]);
+		if (err != 0) {
+			__atomic_store_n (&stopping, true, __ATOMIC_SEQ_CST);
+			strand_park_notify (&park, UINT_MAX);
+			pthread_mutex_unlock (&lock);
+			while (i-- > 0) {
+				pthread_join (w[i].thread, NULL);
+			}
+			pthread_mutex_lock (&lock);
+			workers = NULL;
+			nworkers = 0;
+			free (w);
+			rc = -err;
+			break;
+		}
+	}
+
+out:
+	pthread_mutex_unlock (&lock);
+	return rc;
+}
+
+void
+strand_parallel_stop (void)
+{
+	pthread_mutex_lock (&lock);
+	Worker *w = workers;
+	unsigned n = nworkers;
+	__atomic_store_n (&stopping, true, __ATOMIC_SEQ_CST);
+	strand_park_notify (&park, UINT_MAX);
+	pthread_mutex_unlock (&lock);
+
+	if (w == NULL) {
+		return;
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		pthread_join (w[i].thread, NULL);
+		pthread_mutex_destroy (&w[i].lock);
+	}
+
+	pthread_mutex_lock (&lock);
+	workers = NULL;
+	nworkers = 0;
+	pthread_mutex_unlock (&lock);
+
+	free (w);
+}
+
+void
+strand_parallel_stats (StrandParkStats *st)
+{
+	strand_park_stats (&park, st);
+}
+
+int
+strand_parallel_for (size_t begin, size_t end, size_t grain,
+		void (*fn)(void *, size_t, size_t), void *data)
+{
+	assert (fn != NULL);
+
+	if (begin >= end) {
+		return 0;
+	}
+	if (grain == 0) {
+		grain = 1;
+	}
+
+	if (self != NULL) {
+		if (running != NULL) {
+			fork_join (running, begin, end, grain, fn, data);
+		}
+		else {
+			range_run (begin, end, grain, fn, data);
+		}
+		return 0;
+	}
+
+	if (workers == NULL) {
+		int rc = strand_parallel_start (0);
+		if (rc < 0 && rc != -EALREADY) {
+			return rc;
+		}
+	}
+
+	Join join = { .count = 1, .waiter = NULL };
+	Task root = {
+		.fn = fn, .data = data,
+		.begin = begin, .end = end, .grain = grain,
+		.join = &join
+	};
+
+	task_push (&root);
+
+	pthread_mutex_lock (&lock);
+	while (!join.done) {
+		pthread_cond_wait (&done, &lock);
+	}
+	pthread_mutex_unlock (&lock);
+
+	return 0;
+}
+
@@ -0,0 +1,95 @@
+#ifndef STRAND_PARALLEL_H
+#define STRAND_PARALLEL_H
+
+#include "strand.h"
+#include "park.h"
+
+#include <stddef.h>
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+/**
+ * Starts the worker pool used by `strand_parallel_for`
+ *
+ * Each worker is a thread that runs range tasks as coroutines. A task that
+ * waits on its own sub-ranges is suspended rather than blocking the worker,
+ * and it may be resumed by any worker once its sub-ranges complete. This
+ * only needs to be called to control the number of workers. Otherwise, the
+ * first call to `strand_parallel_for` will start one worker per online CPU.
+ *
+ * @param  nworkers  number of worker threads or 0 for one per online CPU
+ * @return  0 on success, `-EALREADY` if running, or `-errno` on error
+ */
+extern int
+strand_parallel_start (unsigned nworkers);
+
+/**
+ * Pin each worker thread to a separate CPU
+ */
+#define STRAND_PARALLEL_FPIN (UINT32_C(1) << 0)
+
+/**
+ * Starts the worker pool with configuration flags
+ *
+ * When `STRAND_PARALLEL_FPIN` is set, workers are pinned in order to the
+ * CPUs available to the process. Combined with the `STRAND_FNUMA` coroutine
+ * flag, this keeps each worker's stacks on its local node.
+ *
+ * @param  nworkers  number of worker threads or 0 for one per online CPU
+ * @param  flags     pool configuration flags
+ * @return  0 on success, `-EALREADY` if running, or `-errno` on error
+ */
+extern int
+strand_parallel_start_config (unsigned nworkers, uint32_t flags);
+
+/**
+ * Stops and joins the worker pool
+ *
+ * No `strand_parallel_for` calls may be in progress.
+ */
+extern void
+strand_parallel_stop (void);
+
+/**
+ * Invokes a function over a range split into tasks across the worker pool
+ *
+ * The range `[begin, end)` is recursively halved until each piece is no
+ * larger than `grain`, and `fn` is invoked once for each piece. Pieces run
+ * concurrently, so `fn` must be thread-safe.
+ *
+ * This may be called from within `fn` to fork a nested range. In that case
+ * the calling task is suspended until the nested range completes, and the
+ * worker thread continues with other tasks in the meantime. When called
+ * from outside the pool, the calling thread blocks until the range has
+ * completed.
+ *
+ * @param  begin  first index of the range
+ * @param  end    index after the last in the range
+ * @param  grain  maximum number of indexes handled by one call of `fn`
+ * @param  fn     function to invoke with `data` and a sub-range
+ * @param  data   user pointer to pass to `fn`
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_parallel_for (size_t begin, size_t end, size_t grain,
+		void (*fn)(void *, size_t, size_t), void *data);
+
+/**
+ * Gets the parking counters of the idle workers
+ *
+ * Idle workers spin briefly and then sleep in a `StrandPark` until a task
+ * is queued.
+ *
+ * @param  st  stats object to fill in
+ */
+extern void
+strand_parallel_stats (StrandParkStats *st);
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
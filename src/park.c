@@ -0,0 +1,174 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "park.h"
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <assert.h>
+
+#if STRAND_LINUX
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
+
+/**
+ * Minimum number of spin iterations on more than one CPU
+ */
+#define SPIN_MIN 16
+
+static int ncpus = 0;
+
+/**
+ * Hints to the CPU that this is a spin loop
+ */
+static inline void
+cpu_relax (void)
+{
+#if STRAND_X86_64 || STRAND_X86_32
+	__builtin_ia32_pause ();
+#endif
+}
+
+/**
+ * Gets the number of spin iterations for the next wait
+ *
+ * @param  p  parking place
+ * @return  iteration count
+ */
+static uint32_t
+spin_limit (StrandPark *p)
+{
+	int n = __atomic_load_n (&ncpus, __ATOMIC_RELAXED);
+	if (n == 0) {
+		long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? (int)cpus : 1;
+		__atomic_store_n (&ncpus, n, __ATOMIC_RELAXED);
+	}
+	return n > 1 ? __atomic_load_n (&p->spin, __ATOMIC_RELAXED) : 0;
+}
+
+/**
+ * Sleeps until the sequence of a parking place changes
+ *
+ * This may return early, so the caller must test its condition again.
+ *
+ * @param  p    parking place
+ * @param  seq  sequence observed before the final test of the condition
+ */
+static void
+sleep_on (StrandPark *p, uint32_t seq)
+{
+#if STRAND_LINUX
+	syscall (SYS_futex, &p->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+	pthread_mutex_lock (&p->lock);
+	while (__atomic_load_n (&p->seq, __ATOMIC_SEQ_CST) == seq) {
+		pthread_cond_wait (&p->cond, &p->lock);
+	}
+	pthread_mutex_unlock (&p->lock);
+#endif
+}
+
+void
+strand_park_init (StrandPark *p)
+{
+	assert (p != NULL);
+
+	memset (p, 0, sizeof (*p));
+	p->spin = STRAND_PARK_SPIN;
+	pthread_mutex_init (&p->lock, NULL);
+	pthread_cond_init (&p->cond, NULL);
+}
+
+void
+strand_park_wait (StrandPark *p, bool (*ready)(void *), void *data)
+{
+	assert (p != NULL);
+	assert (ready != NULL);
+	assert (strand_current () == NULL);
+
+	uint32_t limit = spin_limit (p);
+	for (uint32_t i = 0; i < limit; i++) {
+		if (ready (data)) {
+			__atomic_fetch_add (&p->spins, 1, __ATOMIC_RELAXED);
+			if (limit < STRAND_PARK_SPIN_MAX) {
+				__atomic_store_n (&p->spin, limit * 2, __ATOMIC_RELAXED);
+			}
+			return;
+		}
+		cpu_relax ();
+	}
+
+	bool slept = false;
+	while (true) {
+		// registering before the final test pairs with the fence in
+		// `strand_park_notify`, so either the condition is seen here or
+		// the waiter is seen there
+		__atomic_fetch_add (&p->waiters, 1, __ATOMIC_SEQ_CST);
+		uint32_t seq = __atomic_load_n (&p->seq, __ATOMIC_SEQ_CST);
+		if (ready (data)) {
+			__atomic_fetch_sub (&p->waiters, 1, __ATOMIC_SEQ_CST);
+			break;
+		}
+
+		__atomic_fetch_add (&p->parks, 1, __ATOMIC_RELAXED);
+		sleep_on (p, seq);
+		__atomic_fetch_sub (&p->waiters, 1, __ATOMIC_SEQ_CST);
+		slept = true;
+
+		if (ready (data)) {
+			break;
+		}
+		__atomic_fetch_add (&p->spurious, 1, __ATOMIC_RELAXED);
+	}
+
+	if (slept && limit > 0) {
+		__atomic_store_n (&p->spin, limit / 2 > SPIN_MIN ? limit / 2 : SPIN_MIN,
+				__ATOMIC_RELAXED);
+	}
+}
+
+void
+strand_park_notify (StrandPark *p, unsigned n)
+{
+	assert (p != NULL);
+
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&p->waiters, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+
+	__atomic_fetch_add (&p->seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add (&p->wakes, 1, __ATOMIC_RELAXED);
+
+#if STRAND_LINUX
+	syscall (SYS_futex, &p->seq, FUTEX_WAKE_PRIVATE, n > INT_MAX ? INT_MAX : (int)n,
+			NULL, NULL, 0);
+#else
+	pthread_mutex_lock (&p->lock);
+	if (n == 1) {
+		pthread_cond_signal (&p->cond);
+	}
+	else {
+		pthread_cond_broadcast (&p->cond);
+	}
+	pthread_mutex_unlock (&p->lock);
+#endif
+}
+
+void
+strand_park_stats (const StrandPark *p, StrandParkStats *st)
+{
+	assert (p != NULL);
+	assert (st != NULL);
+
+	st->parks = __atomic_load_n (&p->parks, __ATOMIC_RELAXED);
+	st->spins = __atomic_load_n (&p->spins, __ATOMIC_RELAXED);
+	st->wakes = __atomic_load_n (&p->wakes, __ATOMIC_RELAXED);
+	st->spurious = __atomic_load_n (&p->spurious, __ATOMIC_RELAXED);
+}
+
@@ -0,0 +1,109 @@
+#ifndef STRAND_PARK_H
+#define STRAND_PARK_H
+
+#include "strand.h"
+
+#include <pthread.h>
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+/**
+ * Initial number of spin iterations before a thread parks
+ */
+#define STRAND_PARK_SPIN 64
+
+/**
+ * Maximum number of spin iterations before a thread parks
+ */
+#define STRAND_PARK_SPIN_MAX 8192
+
+/**
+ * A place for idle threads to sleep until notified
+ *
+ * A waiting thread first spins on its condition, then sleeps on a futex
+ * word. The spin length adapts: it doubles each time the condition became
+ * true while spinning, and halves each time the thread had to sleep. On a
+ * single CPU there is nothing to wait for while spinning, so threads sleep
+ * right away.
+ *
+ * Notifying is a single load while no thread is parked. The system call
+ * to wake a thread is only made once a thread has registered to sleep.
+ *
+ * On systems without futexes, a mutex and condition variable are used.
+ */
+typedef struct {
+	uint32_t seq;
+	uint32_t waiters;
+	uint32_t spin;
+	uint64_t parks, spins, wakes, spurious;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} StrandPark;
+
+typedef struct {
+	uint64_t parks;    /** times a thread went to sleep */
+	uint64_t spins;    /** waits that ended while spinning */
+	uint64_t wakes;    /** wake system calls made by notifiers */
+	uint64_t spurious; /** wakeups that found the condition still false */
+} StrandParkStats;
+
+/**
+ * Static initializer for a `StrandPark`
+ */
+#define STRAND_PARK_INIT { \
+	.spin = STRAND_PARK_SPIN, \
+	.lock = PTHREAD_MUTEX_INITIALIZER, \
+	.cond = PTHREAD_COND_INITIALIZER \
+}
+
+/**
+ * Initializes a parking place
+ *
+ * @param  p  parking place
+ */
+extern void
+strand_park_init (StrandPark *p);
+
+/**
+ * Waits until a condition is true
+ *
+ * The condition is tested by calling `ready`. It must become true before
+ * the matching `strand_park_notify`, and changes to it must be visible to
+ * other threads, such as by using atomic operations.
+ *
+ * A parked thread cannot run any of its coroutines, so this may only be
+ * called outside of a coroutine.
+ *
+ * @param  p      parking place
+ * @param  ready  function that tests the condition
+ * @param  data   user pointer to pass to `ready`
+ */
+extern void
+strand_park_wait (StrandPark *p, bool (*ready)(void *), void *data);
+
+/**
+ * Wakes parked threads after making a condition true
+ *
+ * @param  p  parking place
+ * @param  n  maximum number of threads to wake
+ */
+extern void
+strand_park_notify (StrandPark *p, unsigned n);
+
+/**
+ * Gets the counters of a parking place
+ *
+ * @param  p   parking place
+ * @param  st  stats object to fill in
+ */
+extern void
+strand_park_stats (const StrandPark *p, StrandParkStats *st);
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
@@ -0,0 +1,243 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "perf.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#if STRAND_LINUX
+# define PERF 1
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+bool strand_perf_active = false;
+
+#if PERF
+
+/**
+ * Hardware counters of a thread
+ *
+ * Each counter is mapped so it can be read with `rdpmc` when the kernel
+ * allows it, falling back to `read`. `last` holds the values at the
+ * previous switch, and is only valid while `epoch` matches the global one.
+ */
+typedef struct {
+	int state;
+	uint32_t epoch;
+	int fd[PERF_COUNT];
+	struct perf_event_mmap_page *page[PERF_COUNT];
+	uint64_t last[PERF_COUNT];
+} Perf;
+
+#define PERF_CLOSED 0 /** not opened on this thread */
+#define PERF_OPEN   1 /** counting */
+#define PERF_FAILED 2 /** not permitted or not supported */
+
+static const uint64_t configs[PERF_COUNT] = {
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static __thread Perf perf = { .state = PERF_CLOSED };
+static __thread int perf_err = 0;
+
+/**
+ * Incremented each time counting is enabled
+ *
+ * Counts taken while disabled are stale, so threads read their counters
+ * again before attributing anything once this changes.
+ */
+static uint32_t epoch = 0;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+static void
+perf_close (void)
+{
+	for (int i = 0; i < PERF_COUNT; i++) {
+		if (perf.page[i] != NULL) {
+			munmap (perf.page[i], getpagesize ());
+			perf.page[i] = NULL;
+		}
+		if (perf.fd[i] >= 0) {
+			close (perf.fd[i]);
+			perf.fd[i] = -1;
+		}
+	}
+}
+
+/**
+ * Closes the counters of an exiting thread
+ *
+ * @param  data  unused key value
+ */
+static void
+perf_release (void *data)
+{
+	(void)data;
+	perf_close ();
+	perf.state = PERF_CLOSED;
+}
+
+static void
+key_create (void)
+{
+	pthread_key_create (&key, perf_release);
+}
+
+/**
+ * Reads a counter
+ *
+ * @param  i  counter index
+ * @return  current count
+ */
+static uint64_t
+perf_read (int i)
+{
+#if STRAND_X86_64 || STRAND_X86_32
+	struct perf_event_mmap_page *pc = perf.page[i];
+	if (pc != NULL) {
+		uint32_t seq, idx;
+		uint64_t count;
+		do {
+			seq = __atomic_load_n (&pc->lock, __ATOMIC_ACQUIRE);
+			idx = pc->index;
+			count = pc->offset;
+			if (!pc->cap_user_rdpmc || idx == 0) {
+				break;
+			}
+			uint32_t lo, hi;
+			__asm__ __volatile__ ("rdpmc" : "=a" (lo), "=d" (hi) : "c" (idx - 1));
+			int64_t pmc = (int64_t)(((uint64_t)hi << 32) | lo);
+			int shift = 64 - pc->pmc_width;
+			count += (uint64_t)((pmc << shift) >> shift);
+			__atomic_thread_fence (__ATOMIC_ACQUIRE);
+			if (__atomic_load_n (&pc->lock, __ATOMIC_RELAXED) == seq) {
+				return count;
+			}
+		} while (true);
+	}
+#endif
+
+	uint64_t val = 0;
+	if (read (perf.fd[i], &val, sizeof val) != sizeof val) {
+		return 0;
+	}
+	return val;
+}
+
+/**
+ * Takes the current counts as the start of the next interval
+ */
+static void
+perf_sync (void)
+{
+	perf.epoch = __atomic_load_n (&epoch, __ATOMIC_RELAXED);
+	for (int i = 0; i < PERF_COUNT; i++) {
+		perf.last[i] = perf_read (i);
+	}
+}
+
+/**
+ * Opens the counters for the calling thread
+ *
+ * @return  0 on success or `-errno` on error
+ */
+static int
+perf_open (void)
+{
+	for (int i = 0; i < PERF_COUNT; i++) {
+		perf.fd[i] = -1;
+		perf.page[i] = NULL;
+	}
+
+	for (int i = 0; i < PERF_COUNT; i++) {
+		struct perf_event_attr attr;
+		memset (&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		perf.fd[i] = syscall (SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		if (perf.fd[i] < 0) {
+			int err = errno;
+			perf_close ();
+			perf.state = PERF_FAILED;
+			return -err;
+		}
+
+		void *page = mmap (NULL, getpagesize (), PROT_READ, MAP_SHARED, perf.fd[i], 0);
+		perf.page[i] = page == MAP_FAILED ? NULL : page;
+	}
+
+	perf_sync ();
+	perf.state = PERF_OPEN;
+
+	pthread_once (&once, key_create);
+	pthread_setspecific (key, &perf);
+	return 0;
+}
+
+#endif
+
+void
+strand_perf_switch (uint64_t *acc)
+{
+#if PERF
+	if (perf.state != PERF_OPEN) {
+		if (perf.state == PERF_FAILED) {
+			return;
+		}
+		perf_err = perf_open ();
+		return;
+	}
+	if (perf.epoch != __atomic_load_n (&epoch, __ATOMIC_RELAXED)) {
+		perf_sync ();
+		return;
+	}
+
+	for (int i = 0; i < PERF_COUNT; i++) {
+		uint64_t now = perf_read (i);
+		acc[i] += now - perf.last[i];
+		perf.last[i] = now;
+	}
+#else
+	(void)acc;
+#endif
+}
+
+int
+strand_perf_enable (bool enable)
+{
+	int rc = 0;
+#if PERF
+	if (enable && !__atomic_load_n (&strand_perf_active, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch (&epoch, 1, __ATOMIC_RELAXED);
+		if (perf.state == PERF_OPEN) {
+			perf_sync ();
+		}
+	}
+
+	if (enable && perf.state == PERF_CLOSED) {
+		rc = perf_err = perf_open ();
+	}
+	else if (enable && perf.state == PERF_FAILED) {
+		rc = perf_err;
+	}
+#else
+	rc = enable ? -ENOTSUP : 0;
+#endif
+	__atomic_store_n (&strand_perf_active, enable, __ATOMIC_RELEASE);
+	return rc;
+}
+
@@ -0,0 +1,46 @@
+#ifndef STRAND_PERF_H
+#define STRAND_PERF_H
+
+#include "strand.h"
+#include "config.h"
+
+/**
+ * Number of hardware counters accumulated for each coroutine
+ */
+#define PERF_COUNT 3
+
+/**
+ * Set while hardware counters are being attributed to coroutines
+ *
+ * This is exported for the fast paths in "strand_inline.h".
+ */
+extern bool strand_perf_active
+	__attribute__ ((visibility ("default")));
+
+/**
+ * Adds the counts since the previous switch on this thread to a coroutine
+ *
+ * The counters for the calling thread are opened on first use. If they
+ * cannot be opened, nothing is added.
+ *
+ * @param  acc  counters of the coroutine giving up context
+ */
+extern void
+strand_perf_switch (uint64_t *acc)
+	__attribute__ ((cold, noinline));
+
+/**
+ * Accumulates counters if attribution is enabled
+ *
+ * When attribution is disabled this costs a single, well-predicted branch.
+ *
+ * @param  acc  counters of the coroutine giving up context
+ */
+#define perf_switch(acc) do {                          \
+	if (__builtin_expect (strand_perf_active, 0)) {    \
+		strand_perf_switch ((acc));                    \
+	}                                                  \
+} while (0)
+
+#endif
+
@@ -0,0 +1,247 @@
+#include "pool.h"
+#include "strand_inline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+typedef struct {
+	void (*fn) (void *);
+	void *arg;
+} Job;
+
+/**
+ * Pool state
+ *
+ * Idle workers are kept in a stack so that the most recently used worker,
+ * whose stack is the most likely to still be cached, is reused first. The
+ * stack always has room for every worker. Queued jobs are kept in a ring
+ * that doubles in size when full.
+ */
+struct StrandPool {
+	Strand **idle;
+	size_t nidle, idle_size;
+	Job *queue;
+	size_t head, count, queue_size;
+	size_t workers, peak;
+	uint64_t ticks;
+	unsigned min, max;
+	uint64_t completed, created, retired;
+};
+
+/**
+ * Dispatch loop of a worker
+ *
+ * Queued jobs are taken directly after finishing a job, without switching
+ * back to the caller. The job is copied before it runs, as it is passed on
+ * the stack of the submitting context.
+ *
+ * @param  data  pool pointer
+ * @param  val   pointer to the first job
+ * @return  never returns
+ */
+static uintptr_t
+worker_main (void *data, uintptr_t val)
+{
+	StrandPool *p = data;
+	Strand *self = strand_current ();
+	Job j = *(const Job *)val;
+
+	while (true) {
+		j.fn (j.arg);
+		p->completed++;
+
+		if (p->count > 0) {
+			j = p->queue[p->head];
+			p->head = (p->head + 1) % p->queue_size;
+			p->count--;
+			continue;
+		}
+
+		p->idle[p->nidle++] = self;
+		j = *(const Job *)strand_yield_inline (0);
+	}
+
+	return 0;
+}
+
+/**
+ * Creates a worker and ensures the idle stack has room for it
+ *
+ * @param  p  pool
+ * @return  worker or `NULL` on error
+ */
+static Strand *
+worker_new (StrandPool *p)
+{
+	if (p->workers == p->idle_size) {
+		size_t n = p->idle_size ? p->idle_size * 2 : 8;
+		Strand **tmp = realloc (p->idle, n * sizeof (*tmp));
+		if (tmp == NULL) {
+			return NULL;
+		}
+		p->idle = tmp;
+		p->idle_size = n;
+	}
+
+	Strand *w = strand_new (worker_main, p);
+	if (w != NULL) {
+		p->workers++;
+		p->created++;
+	}
+	return w;
+}
+
+/**
+ * Frees the least recently used idle workers beyond the recent peak
+ *
+ * @param  p  pool
+ */
+static void
+pool_trim (StrandPool *p)
+{
+	size_t keep = p->peak > p->min ? p->peak : p->min;
+	size_t n = 0;
+	while (n < p->nidle && p->workers - n > keep) {
+		strand_free (&p->idle[n]);
+		n++;
+	}
+
+	if (n > 0) {
+		memmove (p->idle, p->idle + n, (p->nidle - n) * sizeof (*p->idle));
+		p->nidle -= n;
+		p->workers -= n;
+		p->retired += n;
+	}
+	p->peak = p->workers - p->nidle;
+}
+
+/**
+ * Adds a job to the end of the queue
+ *
+ * @param  p    pool
+ * @param  job  job to copy
+ * @return  0 on success or `-errno` on error
+ */
+static int
+queue_push (StrandPool *p, Job job)
+{
+	if (p->count == p->queue_size) {
+		size_t n = p->queue_size ? p->queue_size * 2 : 16;
+		Job *q = malloc (n * sizeof (*q));
+		if (q == NULL) {
+			return -errno;
+		}
+		for (size_t i = 0; i < p->count; i++) {
+			q[i] = p->queue[(p->head + i) % p->queue_size];
+		}
+		free (p->queue);
+		p->queue = q;
+		p->queue_size = n;
+		p->head = 0;
+	}
+
+	p->queue[(p->head + p->count) % p->queue_size] = job;
+	p->count++;
+	return 0;
+}
+
+StrandPool *
+strand_pool_new (unsigned min, unsigned max)
+{
+	StrandPool *p = calloc (1, sizeof (*p));
+	if (p == NULL) {
+		return NULL;
+	}
+
+	p->min = min;
+	p->max = max > 0 && max < min ? min : max;
+
+	for (unsigned i = 0; i < min; i++) {
+		Strand *w = worker_new (p);
+		if (w == NULL) {
+			int err = errno;
+			strand_pool_free (&p);
+			errno = err;
+			return NULL;
+		}
+		p->idle[p->nidle++] = w;
+	}
+
+	return p;
+}
+
+void
+strand_pool_free (StrandPool **pp)
+{
+	assert (pp != NULL);
+
+	StrandPool *p = *pp;
+	if (p == NULL) {
+		return;
+	}
+	*pp = NULL;
+
+	assert (p->count == 0);
+	assert (p->nidle == p->workers);
+
+	for (size_t i = 0; i < p->nidle; i++) {
+		strand_free (&p->idle[i]);
+	}
+	free (p->idle);
+	free (p->queue);
+	free (p);
+}
+
+int
+strand_pool_submit (StrandPool *p, void (*fn)(void *), void *arg)
+{
+	assert (p != NULL);
+	assert (fn != NULL);
+
+	if (++p->ticks % STRAND_POOL_PERIOD == 0) {
+		pool_trim (p);
+	}
+
+	Job j = { .fn = fn, .arg = arg };
+	Strand *w = NULL;
+
+	if (p->nidle > 0) {
+		w = p->idle[--p->nidle];
+	}
+	else if (p->max == 0 || p->workers < p->max) {
+		w = worker_new (p);
+		// without any worker, a queued job would never run
+		if (w == NULL && p->workers == 0) {
+			return -errno;
+		}
+	}
+
+	if (w == NULL) {
+		return queue_push (p, j);
+	}
+
+	size_t busy = p->workers - p->nidle;
+	if (busy > p->peak) {
+		p->peak = busy;
+	}
+
+	strand_resume_inline (w, (uintptr_t)&j);
+	return 0;
+}
+
+void
+strand_pool_stats (const StrandPool *p, StrandPoolStats *st)
+{
+	assert (p != NULL);
+	assert (st != NULL);
+
+	st->workers = p->workers;
+	st->idle = p->nidle;
+	st->queued = p->count;
+	st->completed = p->completed;
+	st->created = p->created;
+	st->retired = p->retired;
+}
+
@@ -0,0 +1,99 @@
+#ifndef STRAND_POOL_H
+#define STRAND_POOL_H
+
+#include "strand.h"
+
+#include <stddef.h>
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+/**
+ * A set of long-lived coroutines that run submitted jobs
+ *
+ * Each worker runs a dispatch loop that receives a job through the value
+ * passed to `strand_resume`, runs it, and yields once it is done. Idle
+ * workers are reused most recently used first, so a job normally costs
+ * two context switches on a stack that is already warm.
+ *
+ * A pool belongs to the thread that created it. Jobs may suspend their
+ * worker, such as with `strand_blocking`, and the worker is only returned
+ * to the pool once its job finishes. Values set with `strand_local_set` and
+ * calls registered with `strand_defer` are kept by the worker, and are only
+ * released when the worker is freed.
+ */
+typedef struct StrandPool StrandPool;
+
+typedef struct {
+	size_t workers;     /** workers currently alive */
+	size_t idle;        /** workers waiting for a job */
+	size_t queued;      /** jobs waiting for a worker */
+	uint64_t completed; /** jobs run to completion */
+	uint64_t created;   /** workers created */
+	uint64_t retired;   /** idle workers freed when shrinking */
+} StrandPoolStats;
+
+/**
+ * Number of submitted jobs between checks for surplus idle workers
+ */
+#define STRAND_POOL_PERIOD 256
+
+/**
+ * Creates a pool of worker coroutines
+ *
+ * `min` workers are created immediately using the configuration set with
+ * `strand_configure`. More are added when a job is submitted while every
+ * worker is busy, up to `max`. Once that limit is reached, jobs are queued
+ * and taken by the next worker to finish.
+ *
+ * Every `STRAND_POOL_PERIOD` submitted jobs, the pool frees the least
+ * recently used idle workers beyond the most that were busy at once during
+ * the period, but never goes below `min`.
+ *
+ * @param  min  number of workers to keep
+ * @param  max  maximum number of workers or 0 for no limit
+ * @return  pool or `NULL` on error
+ */
+extern StrandPool *
+strand_pool_new (unsigned min, unsigned max);
+
+/**
+ * Frees a pool and its workers
+ *
+ * No jobs may be running or queued.
+ *
+ * @param  pp  reference to the pool pointer
+ */
+extern void
+strand_pool_free (StrandPool **pp);
+
+/**
+ * Runs a job on a worker of the pool
+ *
+ * If a worker is available, the job starts immediately and this returns
+ * once it has finished or suspended its worker. Otherwise the job is queued.
+ *
+ * @param  p    pool
+ * @param  fn   function to invoke
+ * @param  arg  argument to pass to `fn`
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_pool_submit (StrandPool *p, void (*fn)(void *), void *arg);
+
+/**
+ * Gets the counters of a pool
+ *
+ * @param  p   pool
+ * @param  st  stats object to fill in
+ */
+extern void
+strand_pool_stats (const StrandPool *p, StrandPoolStats *st);
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
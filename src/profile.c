@@ -0,0 +1,460 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#if STRAND_LINUX && (STRAND_X86_64 || STRAND_X86_32)
+# define PROFILE 1
+# include <signal.h>
+# include <time.h>
+# include <ucontext.h>
+# include <unistd.h>
+#endif
+
+#if STRAND_EXECINFO
+# include <execinfo.h>
+#endif
+
+/**
+ * Maximum number of frames recorded for each sample
+ */
+#ifndef STRAND_PROFILE_DEPTH
+# define STRAND_PROFILE_DEPTH 32
+#endif
+
+/**
+ * Number of samples held by each thread's buffer
+ *
+ * Samples are dropped once the buffer is full.
+ */
+#ifndef STRAND_PROFILE_SIZE
+# define STRAND_PROFILE_SIZE 4096
+#endif
+
+#if PROFILE
+
+#if STRAND_X86_64
+# define REG_PC REG_RIP
+# define REG_FP REG_RBP
+#else
+# define REG_PC REG_EIP
+# define REG_FP REG_EBP
+#endif
+
+typedef struct Sample Sample;
+typedef struct Profile Profile;
+
+struct Sample {
+	const void *site;
+	bool strand;
+	int depth;
+	void *pcs[STRAND_PROFILE_DEPTH];
+};
+
+/**
+ * Sample buffer for a thread
+ *
+ * Samples are only written by the signal handler on the owning thread.
+ * `count` is published after each sample is complete. Once the owning
+ * thread exits, the buffer is kept for dumping while it holds samples, and
+ * is `retired` so that the next thread to start profiling reuses it.
+ */
+struct Profile {
+	Profile *next;
+	timer_t timer;
+	bool armed, retired;
+	uintptr_t lo, hi;
+	size_t count, dropped;
+	Sample samples[STRAND_PROFILE_SIZE];
+};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Profile *profiles = NULL;
+static int install_err = 0;
+static pthread_key_t key;
+
+static __thread Profile *prof = NULL;
+
+/**
+ * Records a sample of the current coroutine
+ *
+ * The frame pointer chain is followed from the interrupted frame for as
+ * long as it stays within the stack of the current coroutine, or within the
+ * thread stack when no coroutine is current. This prevents following stale
+ * frame pointers across a context switch.
+ */
+static void
+on_sample (int sig, siginfo_t *info, void *uctx)
+{
+	(void)sig;
+	(void)info;
+
+	Profile *p = prof;
+	if (p == NULL) {
+		return;
+	}
+	if (p->count >= STRAND_PROFILE_SIZE) {
+		p->dropped++;
+		return;
+	}
+
+	Sample *smp = &p->samples[p->count];
+	uintptr_t lo, hi;
+
+	smp->strand = strand_sample (&smp->site, &lo, &hi);
+	if (!smp->strand) {
+		smp->site = NULL;
+		lo = p->lo;
+		hi = p->hi;
+	}
+
+	const ucontext_t *uc = uctx;
+	uintptr_t fp = (uintptr_t)uc->uc_mcontext.gregs[REG_FP];
+	smp->pcs[0] = (void *)uc->uc_mcontext.gregs[REG_PC];
+	smp->depth = 1;
+
+	while (smp->depth < STRAND_PROFILE_DEPTH &&
+			fp >= lo && fp + 2*sizeof (uintptr_t) <= hi &&
+			fp % sizeof (uintptr_t) == 0) {
+		const uintptr_t *frame = (const uintptr_t *)fp;
+		if (frame[1] == 0) {
+			break;
+		}
+		smp->pcs[smp->depth++] = (void *)frame[1];
+		if (frame[0] <= fp) {
+			break;
+		}
+		fp = frame[0];
+	}
+
+	__atomic_store_n (&p->count, p->count + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stops sampling on an exiting thread and retires its buffer
+ *
+ * A buffer without samples is freed right away.
+ *
+ * @param  data  profile pointer
+ */
+static void
+profile_release (void *data)
+{
+	Profile *p = data;
+
+	// signals still pending find no buffer once `prof` is cleared
+	prof = NULL;
+	if (p->armed) {
+		timer_delete (p->timer);
+		p->armed = false;
+	}
+
+	pthread_mutex_lock (&lock);
+	if (__atomic_load_n (&p->count, __ATOMIC_ACQUIRE) > 0) {
+		p->retired = true;
+		p = NULL;
+	}
+	else {
+		Profile **link = &profiles;
+		while (*link != p) {
+			link = &(*link)->next;
+		}
+		*link = p->next;
+	}
+	pthread_mutex_unlock (&lock);
+
+	free (p);
+}
+
+static void
+install (void)
+{
+	int err = pthread_key_create (&key, profile_release);
+	if (err != 0) {
+		install_err = err;
+		return;
+	}
+
+	struct sigaction sa;
+	memset (&sa, 0, sizeof sa);
+	sa.sa_sigaction = on_sample;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset (&sa.sa_mask);
+	if (sigaction (SIGPROF, &sa, NULL) < 0) {
+		install_err = errno;
+	}
+}
+
+/**
+ * Takes a retired buffer or allocates and registers a new one for the
+ * calling thread
+ *
+ * The samples of a reused buffer are discarded. The bounds of the thread
+ * stack are recorded for unwinding samples taken outside of coroutines.
+ *
+ * @return  buffer or `NULL` on error
+ */
+static Profile *
+profile_new (void)
+{
+	Profile *p = NULL;
+
+	pthread_mutex_lock (&lock);
+	for (Profile *r = profiles; r != NULL; r = r->next) {
+		if (r->retired) {
+			r->retired = false;
+			p = r;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&lock);
+
+	bool reused = p != NULL;
+	if (!reused && (p = calloc (1, sizeof (*p))) == NULL) {
+		return NULL;
+	}
+	p->lo = p->hi = 0;
+
+	pthread_attr_t attr;
+	if (pthread_getattr_np (pthread_self (), &attr) == 0) {
+		void *addr;
+		size_t size;
+		if (pthread_attr_getstack (&attr, &addr, &size) == 0) {
+			p->lo = (uintptr_t)addr;
+			p->hi = p->lo + size;
+		}
+		pthread_attr_destroy (&attr);
+	}
+
+	if (!reused) {
+		pthread_mutex_lock (&lock);
+		p->next = profiles;
+		profiles = p;
+		pthread_mutex_unlock (&lock);
+	}
+
+	pthread_setspecific (key, p);
+	return p;
+}
+
+/**
+ * Appends the function name for an address to a line
+ *
+ * @param  out   output stream
+ * @param  sym   symbol string from `backtrace_symbols` or `NULL`
+ * @param  addr  address to print if there is no symbol name
+ */
+static void
+print_frame (FILE *out, const char *sym, const void *addr)
+{
+	if (sym != NULL) {
+		const char *start = strchr (sym, '(');
+		if (start != NULL && start[1] != '+' && start[1] != ')') {
+			start++;
+			size_t len = strcspn (start, "+)");
+			fprintf (out, "%.*s", (int)len, start);
+			return;
+		}
+	}
+	fprintf (out, "0x%" PRIxPTR, (uintptr_t)addr);
+}
+
+/**
+ * Formats a sample as a folded stack line without the count
+ *
+ * The line starts with the creation site of the coroutine, or `main` for
+ * samples outside of coroutines, followed by the frames from the outermost
+ * to the innermost.
+ *
+ * @param  smp  sample to format
+ * @return  allocated line or `NULL` on error
+ */
+static char *
+sample_line (const Sample *smp)
+{
+	void *addrs[STRAND_PROFILE_DEPTH + 1];
+	char **syms = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	int n = 0;
+
+	addrs[n++] = (void *)smp->site;
+	for (int i = smp->depth - 1; i >= 0; i--) {
+		// return addresses point after the call, so step back into it
+		addrs[n++] = (uint8_t *)smp->pcs[i] - (i > 0);
+	}
+
+#if STRAND_EXECINFO
+	syms = backtrace_symbols (addrs, n);
+#endif
+
+	FILE *out = open_memstream (&line, &len);
+	if (out == NULL) {
+		free (syms);
+		return NULL;
+	}
+
+	if (smp->strand) {
+		fprintf (out, "strand@");
+		print_frame (out, syms ? syms[0] : NULL, addrs[0]);
+	}
+	else {
+		fprintf (out, "main");
+	}
+	for (int i = 1; i < n; i++) {
+		fputc (';', out);
+		print_frame (out, syms ? syms[i] : NULL, addrs[i]);
+	}
+
+	fclose (out);
+	free (syms);
+	return line;
+}
+
+static int
+line_cmp (const void *a, const void *b)
+{
+	return strcmp (*(char *const *)a, *(char *const *)b);
+}
+
+#endif
+
+int
+strand_profile_start (unsigned hz)
+{
+#if PROFILE
+	if (hz == 0) {
+		return -EINVAL;
+	}
+
+	pthread_once (&once, install);
+	if (install_err != 0) {
+		return -install_err;
+	}
+
+	Profile *p = prof;
+	if (p == NULL && (p = prof = profile_new ()) == NULL) {
+		return -errno;
+	}
+	if (p->armed) {
+		return -EALREADY;
+	}
+
+	struct sigevent sev;
+	memset (&sev, 0, sizeof sev);
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+	sev._sigev_un._tid = gettid ();
+	if (timer_create (CLOCK_THREAD_CPUTIME_ID, &sev, &p->timer) < 0) {
+		return -errno;
+	}
+
+	// samples from an earlier start are discarded, and the handler cannot
+	// write to the buffer until the timer is armed
+	pthread_mutex_lock (&lock);
+	__atomic_store_n (&p->count, 0, __ATOMIC_RELEASE);
+	p->dropped = 0;
+	pthread_mutex_unlock (&lock);
+
+	uint64_t period = UINT64_C(1000000000) / hz;
+	if (period == 0) {
+		period = 1;
+	}
+
+	struct itimerspec its;
+	its.it_interval.tv_sec = period / 1000000000;
+	its.it_interval.tv_nsec = period % 1000000000;
+	its.it_value = its.it_interval;
+	if (timer_settime (p->timer, 0, &its, NULL) < 0) {
+		int err = errno;
+		timer_delete (p->timer);
+		return -err;
+	}
+
+	p->armed = true;
+	return 0;
+#else
+	(void)hz;
+	return -ENOTSUP;
+#endif
+}
+
+void
+strand_profile_stop (void)
+{
+#if PROFILE
+	Profile *p = prof;
+	if (p != NULL && p->armed) {
+		timer_delete (p->timer);
+		p->armed = false;
+	}
+#endif
+}
+
+int
+strand_profile_dump (FILE *out)
+{
+	if (out == NULL) {
+		out = stdout;
+	}
+
+#if PROFILE
+	char **lines = NULL;
+	size_t n = 0, cap = 0;
+	int rc = 0;
+
+	pthread_mutex_lock (&lock);
+	for (Profile *p = profiles; p != NULL && rc == 0; p = p->next) {
+		size_t count = __atomic_load_n (&p->count, __ATOMIC_ACQUIRE);
+		for (size_t i = 0; i < count; i++) {
+			if (n == cap) {
+				size_t ncap = cap ? cap * 2 : 256;
+				char **tmp = realloc (lines, ncap * sizeof (*lines));
+				if (tmp == NULL) {
+					rc = -errno;
+					break;
+				}
+				lines = tmp;
+				cap = ncap;
+			}
+			if ((lines[n] = sample_line (&p->samples[i])) == NULL) {
+				rc = -errno;
+				break;
+			}
+			n++;
+		}
+	}
+	pthread_mutex_unlock (&lock);
+
+	qsort (lines, n, sizeof (*lines), line_cmp);
+	for (size_t i = 0; i < n; ) {
+		size_t j = i + 1;
+		while (j < n && strcmp (lines[i], lines[j]) == 0) {
+			j++;
+		}
+		fprintf (out, "%s %zu\n", lines[i], j - i);
+		for (; i < j; i++) {
+			free (lines[i]);
+		}
+	}
+	free (lines);
+
+	fflush (out);
+	if (rc == 0 && ferror (out)) {
+		rc = -EIO;
+	}
+	return rc;
+#else
+	(void)out;
+	return -ENOTSUP;
+#endif
+}
+
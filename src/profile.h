@@ -0,0 +1,21 @@
+#ifndef STRAND_PROFILE_H
+#define STRAND_PROFILE_H
+
+#include "strand.h"
+#include "config.h"
+
+/**
+ * Gets the creation site and stack bounds of the current coroutine
+ *
+ * This only reads thread-local state, so it is async-signal-safe.
+ *
+ * @param  site  return address of the call that created the coroutine
+ * @param  lo    lowest address of the stack
+ * @param  hi    address past the highest address of the stack
+ * @return  `true` if a coroutine is current or `false` for the main context
+ */
+extern bool
+strand_sample (const void **site, uintptr_t *lo, uintptr_t *hi);
+
+#endif
+
@@ -0,0 +1,529 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "shard.h"
+#include "blocking.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <assert.h>
+#include <errno.h>
+
+#if STRAND_LINUX
+# include <sched.h>
+# include <sys/eventfd.h>
+#endif
+
+#if (STRAND_SHARD_RING & (STRAND_SHARD_RING - 1)) != 0
+# error STRAND_SHARD_RING must be a power of 2
+#endif
+
+/**
+ * Maximum number of messages taken from a ring before handling them
+ */
+#define BATCH 64
+
+typedef struct Msg Msg;
+typedef struct Ring Ring;
+typedef struct Shard Shard;
+
+struct Msg {
+	Msg *next;
+	void (*fn) (void *);
+	void *arg;
+};
+
+/**
+ * Messages from one shard to another
+ *
+ * The producer only writes `tail` and the consumer only writes `head`, so
+ * each is kept on its own cache line. The producer keeps a stale copy of
+ * `head` and only reloads it when the ring appears full.
+ */
+struct Ring {
+	uint64_t tail __attribute__((aligned (64)));
+	uint64_t head_cache;
+	uint64_t head __attribute__((aligned (64)));
+	Msg msgs[STRAND_SHARD_RING] __attribute__((aligned (64)));
+};
+
+/**
+ * A thread that owns its coroutines
+ *
+ * `rings` holds the inbound ring from each shard. Messages from other
+ * threads are pushed onto `inbox` without locking, and as the shard only
+ * ever takes the entire list, this is not subject to ABA. `sleeping` is set
+ * while the shard waits on its descriptor, and senders that clear it are
+ * responsible for the wakeup.
+ */
+struct Shard {
+	Ring *rings;
+	Msg *inbox;
+	pthread_t thread;
+	unsigned index;
+	int cpu;
+	int fd[2];
+	bool sleeping __attribute__((aligned (64)));
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Shard *shards = NULL;
+static unsigned nshards = 0;
+static bool stopping = false;
+
+static __thread Shard *self = NULL;
+
+/**
+ * Tests if a shard has messages waiting
+ *
+ * @param  s  shard
+ * @return  `true` if any ring or the inbox is not empty
+ */
+static bool
+shard_pending (Shard *s)
+{
+	if (__atomic_load_n (&s->inbox, __ATOMIC_SEQ_CST) != NULL) {
+		return true;
+	}
+	for (unsigned i = 0; i < nshards; i++) {
+		Ring *r = &s->rings[i];
+		if (__atomic_load_n (&r->tail, __ATOMIC_SEQ_CST) != r->head) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Signals the descriptor of a shard
+ *
+ * @param  s  shard to wake
+ */
+static void
+shard_signal (Shard *s)
+{
+#if STRAND_LINUX
+	uint64_t one = 1;
+	ssize_t rc = write (s->fd[1], &one, sizeof one);
+#else
+	char one = 1;
+	ssize_t rc = write (s->fd[1], &one, sizeof one);
+#endif
+	(void)rc;
+}
+
+/**
+ * Wakes a shard after a message was published to it
+ *
+ * The fence orders the publish before the check of `sleeping`, pairing with
+ * the fence in `shard_sleep` between setting it and checking for messages.
+ *
+ * @param  s  destination shard
+ */
+static void
+shard_wake (Shard *s)
+{
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&s->sleeping, __ATOMIC_RELAXED) &&
+			__atomic_exchange_n (&s->sleeping, false, __ATOMIC_SEQ_CST)) {
+		shard_signal (s);
+	}
+}
+
+/**
+ * Waits until a message or blocking call completion arrives
+ *
+ * @param  s    calling shard
+ * @param  bfd  blocking call completion descriptor or -1
+ */
+static void
+shard_sleep (Shard *s, int bfd)
+{
+	__atomic_store_n (&s->sleeping, true, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	if (!shard_pending (s) && !__atomic_load_n (&stopping, __ATOMIC_SEQ_CST)) {
+		struct pollfd pfd[2] = {
+			{ .fd = s->fd[0], .events = POLLIN },
+			{ .fd = bfd, .events = POLLIN },
+		};
+		poll (pfd, bfd >= 0 ? 2 : 1, -1);
+	}
+
+	__atomic_store_n (&s->sleeping, false, __ATOMIC_SEQ_CST);
+
+#if STRAND_LINUX
+	uint64_t buf;
+#else
+	char buf[64];
+#endif
+	while (read (s->fd[0], &buf, sizeof buf) > 0) {}
+}
+
+/**
+ * Handles the messages waiting in a ring
+ *
+ * Messages are copied out in batches and the slots released before any are
+ * handled, so handlers may send to the same ring.
+ *
+ * @param  r  inbound ring
+ * @return  number of messages handled
+ */
+static size_t
+ring_drain (Ring *r)
+{
+	Msg batch[BATCH];
+	size_t total = 0;
+
+	while (true) {
+		uint64_t head = r->head;
+		uint64_t tail = __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE);
+		size_t n = tail - head;
+		if (n == 0) {
+			return total;
+		}
+		if (n > BATCH) {
+			n = BATCH;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			batch[i] = r->msgs[(head + i) & (STRAND_SHARD_RING - 1)];
+		}
+		__atomic_store_n (&r->head, head + n, __ATOMIC_RELEASE);
+
+		for (size_t i = 0; i < n; i++) {
+			batch[i].fn (batch[i].arg);
+		}
+		total += n;
+	}
+}
+
+/**
+ * Handles the messages sent to a shard from other threads
+ *
+ * @param  s  calling shard
+ * @return  number of messages handled
+ */
+static size_t
+inbox_drain (Shard *s)
+{
+	if (__atomic_load_n (&s->inbox, __ATOMIC_RELAXED) == NULL) {
+		return 0;
+	}
+
+	Msg *list = __sync_lock_test_and_set (&s->inbox, NULL), *fifo = NULL;
+	while (list != NULL) {
+		Msg *next = list->next;
+		list->next = fifo;
+		fifo = list;
+		list = next;
+	}
+
+	size_t n = 0;
+	while (fifo != NULL) {
+		Msg *next = fifo->next;
+		void (*fn) (void *) = fifo->fn;
+		void *arg = fifo->arg;
+		free (fifo);
+		fn (arg);
+		fifo = next;
+		n++;
+	}
+	return n;
+}
+
+static void *
+shard_main (void *data)
+{
+	Shard *s = data;
+	self = s;
+
+	if (s->cpu >= 0) {
+		strand_pin (s->cpu);
+	}
+
+	int bfd = strand_blocking_fd ();
+
+	while (true) {
+		size_t n = strand_shard_poll ();
+		n += strand_blocking_poll ();
+		n += strand_sched_run ();
+		if (n > 0) {
+			continue;
+		}
+		if (__atomic_load_n (&stopping, __ATOMIC_SEQ_CST)) {
+			if (strand_shard_poll () == 0) {
+				break;
+			}
+			continue;
+		}
+		shard_sleep (s, bfd);
+	}
+
+	self = NULL;
+	return NULL;
+}
+
+/**
+ * Assigns a CPU to each shard from the CPUs available to the process
+ *
+ * @param  s  shard array
+ * @param  n  number of shards
+ */
+static void
+shard_pin (Shard *s, unsigned n)
+{
+#if STRAND_LINUX
+	cpu_set_t set;
+	if (sched_getaffinity (0, sizeof set, &set) == 0 && CPU_COUNT (&set) > 0) {
+		int cpu = 0;
+		for (unsigned i = 0; i < n; i++) {
+			while (!CPU_ISSET (cpu, &set)) {
+				cpu = (cpu + 1) % CPU_SETSIZE;
+			}
+			s[i].cpu = cpu;
+			cpu = (cpu + 1) % CPU_SETSIZE;
+		}
+	}
+#else
+	(void)s;
+	(void)n;
+#endif
+}
+
+/**
+ * Opens the wakeup descriptor of a shard
+ *
+ * @param  s  shard
+ * @return  0 on success or `-errno` on error
+ */
+static int
+shard_open (Shard *s)
+{
+#if STRAND_LINUX
+	s->fd[0] = s->fd[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (s->fd[0] < 0) {
+		return -errno;
+	}
+#else
+	if (pipe (s->fd) < 0) {
+		s->fd[0] = s->fd[1] = -1;
+		return -errno;
+	}
+	if (fcntl (s->fd[0], F_SETFL, O_NONBLOCK) < 0 ||
+			fcntl (s->fd[1], F_SETFL, O_NONBLOCK) < 0) {
+		int err = errno;
+		close (s->fd[0]);
+		close (s->fd[1]);
+		s->fd[0] = s->fd[1] = -1;
+		return -err;
+	}
+#endif
+	return 0;
+}
+
+/**
+ * Releases the resources of the shards
+ *
+ * @param  s  shard array
+ * @param  n  number of shards
+ */
+static void
+shard_free (Shard *s, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		if (s[i].fd[0] >= 0) {
+			close (s[i].fd[0]);
+			if (s[i].fd[1] != s[i].fd[0]) {
+				close (s[i].fd[1]);
+			}
+		}
+		for (Msg *m = s[i].inbox, *next; m != NULL; m = next) {
+			next = m->next;
+			free (m);
+		}
+		free (s[i].rings);
+	}
+	free (s);
+}
+
+int
+strand_shard_start (unsigned n)
+{
+	if (n == 0) {
+		long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? (unsigned)cpus : 1;
+	}
+
+	pthread_mutex_lock (&lock);
+
+	int rc = 0;
+	if (shards != NULL) {
+		rc = -EALREADY;
+		goto out;
+	}
+
+	Shard *s = calloc (n, sizeof (*s));
+	if (s == NULL) {
+		rc = -errno;
+		goto out;
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		s[i].index = i;
+		s[i].cpu = -1;
+		s[i].fd[0] = s[i].fd[1] = -1;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		void *rings;
+		int err = posix_memalign (&rings, 64, n * sizeof (Ring));
+		if (err != 0) {
+			rc = -err;
+			goto fail;
+		}
+		memset (rings, 0, n * sizeof (Ring));
+		s[i].rings = rings;
+		if ((rc = shard_open (&s[i])) < 0) {
+			goto fail;
+		}
+	}
+
+	shard_pin (s, n);
+
+	shards = s;
+	nshards = n;
+	__atomic_store_n (&stopping, false, __ATOMIC_SEQ_CST);
+
+	for (unsigned i = 0; i < n; i++) {
+		int err = pthread_create (&s[i].thread, NULL, shard_main, &s[i]);
+		if (err != 0) {
+			__atomic_store_n (&stopping, true, __ATOMIC_SEQ_CST);
+			while (i-- > 0) {
+				shard_signal (&s[i]);
+				pthread_join (s[i].thread, NULL);
+			}
+			shards = NULL;
+			nshards = 0;
+			rc = -err;
+			goto fail;
+		}
+	}
+	goto out;
+
+fail:
+	shard_free (s, n);
+out:
+	pthread_mutex_unlock (&lock);
+	return rc;
+}
+
+void
+strand_shard_stop (void)
+{
+	pthread_mutex_lock (&lock);
+
+	Shard *s = shards;
+	unsigned n = nshards;
+	if (s == NULL) {
+		pthread_mutex_unlock (&lock);
+		return;
+	}
+
+	__atomic_store_n (&stopping, true, __ATOMIC_SEQ_CST);
+	for (unsigned i = 0; i < n; i++) {
+		shard_signal (&s[i]);
+	}
+	for (unsigned i = 0; i < n; i++) {
+		pthread_join (s[i].thread, NULL);
+	}
+
+	shards = NULL;
+	nshards = 0;
+	shard_free (s, n);
+
+	pthread_mutex_unlock (&lock);
+}
+
+unsigned
+strand_shard_count (void)
+{
+	return __atomic_load_n (&nshards, __ATOMIC_ACQUIRE);
+}
+
+int
+strand_shard_self (void)
+{
+	return self ? (int)self->index : -1;
+}
+
+int
+strand_shard_send (unsigned shard, void (*fn)(void *), void *arg)
+{
+	assert (fn != NULL);
+
+	if (shard >= nshards) {
+		return -EINVAL;
+	}
+
+	Shard *to = &shards[shard];
+	Shard *from = self;
+
+	if (from == NULL) {
+		Msg *m = malloc (sizeof (*m));
+		if (m == NULL) {
+			return -errno;
+		}
+		m->fn = fn;
+		m->arg = arg;
+
+		Msg *head;
+		do {
+			head = __atomic_load_n (&to->inbox, __ATOMIC_RELAXED);
+			m->next = head;
+		} while (!__sync_bool_compare_and_swap (&to->inbox, head, m));
+
+		shard_wake (to);
+		return 0;
+	}
+
+	Ring *r = &to->rings[from->index];
+	uint64_t tail = r->tail;
+	if (tail - r->head_cache >= STRAND_SHARD_RING) {
+		r->head_cache = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+		if (tail - r->head_cache >= STRAND_SHARD_RING) {
+			return -EAGAIN;
+		}
+	}
+
+	Msg *m = &r->msgs[tail & (STRAND_SHARD_RING - 1)];
+	m->fn = fn;
+	m->arg = arg;
+	__atomic_store_n (&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (to != from) {
+		shard_wake (to);
+	}
+	return 0;
+}
+
+size_t
+strand_shard_poll (void)
+{
+	Shard *s = self;
+	if (s == NULL) {
+		return 0;
+	}
+
+	size_t n = inbox_drain (s);
+	for (unsigned i = 0; i < nshards; i++) {
+		n += ring_drain (&s->rings[i]);
+	}
+	return n;
+}
+
@@ -0,0 +1,103 @@
+#ifndef STRAND_SHARD_H
+#define STRAND_SHARD_H
+
+#include "strand.h"
+
+#include <stddef.h>
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+/**
+ * Number of messages held by the ring between each pair of shards
+ *
+ * This must be a power of 2.
+ */
+#ifndef STRAND_SHARD_RING
+# define STRAND_SHARD_RING 256
+#endif
+
+/**
+ * Starts one pinned thread per core in shared-nothing mode
+ *
+ * Each shard thread owns its coroutines, stack cache, ready queue and
+ * blocking call completions, and work never moves between shards on its
+ * own. Shards exchange messages through a single-producer ring for each
+ * pair of shards, which the receiver drains in batches.
+ *
+ * Each shard runs a loop that handles received messages, resumes
+ * coroutines whose blocking calls have completed, and then runs its ready
+ * queue until it is empty. With nothing left to do, the shard sleeps until
+ * a message or a completion arrives. Coroutines that wait on other shards
+ * should suspend, such as with a future, rather than loop on
+ * `strand_sched_yield`, as that keeps the ready queue from ever emptying.
+ *
+ * @param  nshards  number of shards or 0 for one per online CPU
+ * @return  0 on success, `-EALREADY` if running, or `-errno` on error
+ */
+extern int
+strand_shard_start (unsigned nshards);
+
+/**
+ * Stops and joins the shard threads
+ *
+ * Each shard exits once it has no received messages left to handle.
+ * Messages sent after this is called may not be handled, and suspended
+ * coroutines are not resumed.
+ */
+extern void
+strand_shard_stop (void);
+
+/**
+ * Gets the number of running shards
+ *
+ * @return  shard count or 0 if not running
+ */
+extern unsigned
+strand_shard_count (void);
+
+/**
+ * Gets the index of the shard of the calling thread
+ *
+ * @return  shard index or -1 when not called from a shard
+ */
+extern int
+strand_shard_self (void);
+
+/**
+ * Sends a message to be handled on a shard
+ *
+ * `fn` is invoked with `arg` on the shard's thread outside of any
+ * coroutine, where it may start coroutines with `strand_spawn` or complete
+ * futures. From a shard, this never blocks or allocates. When the ring to
+ * the destination is full, `-EAGAIN` is returned, and the caller should
+ * handle its own messages with `strand_shard_poll` or suspend before trying
+ * again. Messages from threads other than shards are allocated and queued
+ * separately.
+ *
+ * @param  shard  destination shard index
+ * @param  fn     function to invoke on the shard
+ * @param  arg    argument to pass to `fn`
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_shard_send (unsigned shard, void (*fn)(void *), void *arg);
+
+/**
+ * Handles the messages waiting for the calling shard
+ *
+ * This is done by the shard loop, and only needs to be called to make
+ * progress while a send to a full ring is being retried.
+ *
+ * @return  number of messages handled
+ */
+extern size_t
+strand_shard_poll (void);
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
@@ -1,12 +1,26 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include "strand.h"
+#include "strand_inline.h"
+#include "task.h"
 #include "config.h"
 #include "ctx.h"
+#include "trace.h"
+#include "profile.h"
+#include "perf.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <inttypes.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <time.h>
+#include <signal.h>
 #include <assert.h>
 #include <errno.h>
 
@@ -14,10 +28,24 @@
 # include <execinfo.h>
 #endif
 
+#if STRAND_LINUX
+# include <sched.h>
+# include <sys/syscall.h>
+# include <linux/mempolicy.h>
+#endif
+
 #if STRAND_BLOCKS
 # define STRAND_FBLOCK (UINT32_C(1) << 31)
 #endif
 
+#define STRAND_FSPAWN  (UINT32_C(1) << 30) /** freed by the scheduler when dead */
+#define STRAND_FQUEUED (UINT32_C(1) << 29) /** in the ready queue */
+
+/**
+ * Mask of flags that may be configured by users
+ */
+#define FLAGS_USER (UINT32_C(0x0fffffff))
+
 #ifndef STRAND_PAGESIZE
 # define STRAND_PAGESIZE getpagesize()
 #endif
@@ -26,6 +54,80 @@
 # define MAP_STACK 0
 #endif
 
+/**
+ * Maximum number of NUMA nodes tracked
+ *
+ * This matches the single word node mask passed to `mbind`.
+ */
+#define NODE_MAX 64
+
+/**
+ * Maximum number of dead mappings cached by each thread
+ *
+ * When exceeded, the oldest half is moved to the shared caches.
+ */
+#ifndef STRAND_CACHE_MAX
+# define STRAND_CACHE_MAX 64
+#endif
+
+/**
+ * Number of coroutine-local values stored inline in each coroutine
+ *
+ * Values for higher keys are stored in a table allocated on first use.
+ */
+#ifndef STRAND_LOCAL_INLINE
+# define STRAND_LOCAL_INLINE 4
+#endif
+
+/**
+ * Alignment step between the stack tops of `STRAND_FCOLOR` mappings
+ *
+ * This should be the cache line size.
+ */
+#ifndef STRAND_COLOR_STEP
+# define STRAND_COLOR_STEP 64
+#endif
+
+/**
+ * Number of bytes at the top of the stack faulted in by `STRAND_FPREFAULT`
+ */
+#ifndef STRAND_PREFAULT_SIZE
+# define STRAND_PREFAULT_SIZE 16384
+#endif
+
+/**
+ * Number of mappings moved between thread and shared caches at a time
+ */
+#define CACHE_BATCH (STRAND_CACHE_MAX / 2)
+
+/**
+ * Maximum number of frames captured for `STRAND_FCAPTURE`
+ */
+#define CAPTURE_DEPTH 32
+
+/**
+ * Number of hash buckets in each thread's table of captures
+ */
+#define CAPTURE_BUCKETS 256
+
+/**
+ * Tagged pointers for the lock-free shared caches
+ *
+ * The upper bits of a 64-bit word hold a counter that changes on every
+ * update, so a compare-and-swap fails if the head was popped and pushed
+ * back in the meantime. On 64-bit systems this relies on user space
+ * addresses fitting within 48 bits.
+ */
+#if __SIZEOF_POINTER__ == 8
+# define TAG_SHIFT 48
+#else
+# define TAG_SHIFT 32
+#endif
+#define TAG_PTR(t) \
+	((CacheBatch *)(uintptr_t)((t) & ((UINT64_C(1) << TAG_SHIFT) - 1)))
+#define TAG_MAKE(p, t) \
+	((uint64_t)(uintptr_t)(p) | ((((t) >> TAG_SHIFT) + 1) << TAG_SHIFT))
+
 /**
  * The stack size in bytes including the extra space below the corotoutine
  * and the protected page
@@ -34,7 +136,7 @@
  * @return  total size of the stack
  */
 #define STACK_SIZE(s) \
-	((s)->map_size - sizeof (Strand))
+	((s)->map_size - sizeof (Strand) - (s)->color)
 
 /**
  * Get the mapped address from a coroutine
@@ -44,16 +146,30 @@
  */
 #if STACK_GROWS_UP
 # define MAP_BEGIN(s) \
-	((uint8_t *)(s))
+	((uint8_t *)(s) - (s)->color)
 #else
 # define MAP_BEGIN(s) \
-	((uint8_t *)(s) + sizeof (Strand) - (s)->map_size)
+	((uint8_t *)(s) + sizeof (Strand) + (s)->color - (s)->map_size)
+#endif
+
+/**
+ * Get the lowest stack address from a coroutine
+ *
+ * @param  s  coroutine pointer
+ * @return  stack address
+ */
+#if STACK_GROWS_UP
+# define STACK_BEGIN(s) \
+	((uint8_t *)(s) + sizeof (Strand))
+#else
+# define STACK_BEGIN(s) \
+	MAP_BEGIN (s)
 #endif
 
-#define SUSPENDED 0  /** new created or yielded */
-#define CURRENT   1  /** currently has context */
-#define ACTIVE    2  /** is in the parent list of the current */
-#define DEAD      3  /** function has returned */
+#define SUSPENDED STRAND_HEAD_SUSPENDED
+#define CURRENT   STRAND_HEAD_CURRENT
+#define ACTIVE    STRAND_HEAD_ACTIVE
+#define DEAD      STRAND_HEAD_DEAD
 
 /** Maps state integers to name strings */
 static const char *state_names[] = {
@@ -78,23 +194,29 @@ static const char *state_names[] = {
 /**
  * Runtime assert that prints stack and error information before aborting
  *
+ * The reporting is done by `ensure_fail` so that only the test is inlined.
+ *
  * @param  s    coroutine pointer
  * @param  exp  expression to ensure is `true`
  * @param  ...  printf-style expression to print before aborting
  */
 #define ensure(s, exp, ...) do {                             \
 	if (__builtin_expect (!(exp), 0)) {                      \
-		Strand *s_tmp = (s);                                 \
-		fprintf (stderr, __VA_ARGS__);                       \
-		fprintf (stderr, " (" FMT ")\n", FMTARGS(s_tmp));    \
-		for (int i = 0; i < s_tmp->nbacktrace; i++) {        \
-			fprintf (stderr, "\t%s\n", s_tmp->backtrace[i]); \
-		}                                                    \
-		fflush (stderr);                                     \
-		abort ();                                            \
+		ensure_fail ((s), __VA_ARGS__);                      \
 	}                                                        \
 } while (0)
 
+/**
+ * Gets the identity of a coroutine for trace events
+ *
+ * The thread's main context is recorded as `NULL`.
+ *
+ * @param  s  coroutine pointer
+ * @return  coroutine pointer or `NULL`
+ */
+#define TRACE_ID(s) \
+	((s) == &strand_tls_top ? NULL : (s))
+
 /**
  * Test if the coroutine has debugging enabled
  *
@@ -105,21 +227,54 @@ static const char *state_names[] = {
 	__builtin_expect ((s)->flags & STRAND_FDEBUG, 0)
 
 typedef struct StrandDefer StrandDefer;
+typedef struct CacheBatch CacheBatch;
+typedef struct Capture Capture;
 
+/**
+ * Coroutine state
+ *
+ * The fields used by `strand_resume`, `strand_yield` and `entry` come
+ * first and fit within a single cache line, as the object is aligned to
+ * the line size. The leading fields must match `StrandHead` from
+ * "strand_inline.h".
+ */
 struct Strand {
 	uintptr_t ctx[STRAND_CTX_REG_COUNT];
 	Strand *parent;
-	void *data;
 	uintptr_t value;
+	int state, flags;
+	void *data;
 	StrandDefer *defer;
-	char **backtrace;
-	int nbacktrace;
+	StrandTask *task;
+	Strand *ready_next;
+	int priority;
+	uint64_t deadline;
+	const void *site;
+	Capture *capture;
+	Strand *map_next, *map_prev;
 	uint32_t map_size;
-	int state, flags;
+	uint32_t color;
+	int node;
+	void *locals[STRAND_LOCAL_INLINE];
+	void **locals_more;
+	uint64_t perf[PERF_COUNT];
 #if STRAND_VALGRIND
 	unsigned int stack_id;
 #endif
-} __attribute__ ((aligned (16)));
+} __attribute__ ((aligned (64)));
+
+typedef char strand_hot_check[
+	offsetof (Strand, defer) + sizeof (StrandDefer *) <= 64 ? 1 : -1];
+
+#if defined (STRAND_HEAD_REGS)
+# if STRAND_HEAD_REGS != STRAND_CTX_REG_COUNT
+#  error StrandHead does not match the context size
+# endif
+typedef char strand_head_check[
+	offsetof (Strand, parent) == offsetof (StrandHead, parent) &&
+	offsetof (Strand, value) == offsetof (StrandHead, value) &&
+	offsetof (Strand, state) == offsetof (StrandHead, state) ? 1 : -1];
+#endif
 
 struct StrandDefer {
 	StrandDefer *next;
@@ -127,6 +282,81 @@ struct StrandDefer {
 	void *data;
 };
 
+/**
+ * A unique creation backtrace shared by every coroutine created there
+ *
+ * Only the raw return addresses are captured, and symbols are resolved the
+ * first time they are printed. Each coroutine holds a reference, as does
+ * the table of the thread that captured it until that thread exits.
+ */
+struct Capture {
+	Capture *next;
+	uint64_t hash;
+	size_t refs;
+	char **symbols;
+	int nframes;
+	void *frames[];
+};
+
+/**
+ * A list of dead mappings moved between thread caches as a unit
+ *
+ * Batch descriptors are never freed, only recycled through the spare list,
+ * so a descriptor that is read after being popped by another thread is
+ * still valid memory.
+ */
+struct CacheBatch {
+	CacheBatch *next;
+	Strand *head, *tail;
+	size_t count, bytes;
+};
+
+/**
+ * Ready queue of a thread
+ *
+ * Coroutines with a deadline are kept in a binary min-heap ordered by
+ * deadline, and are always run before the others. The rest are kept in a
+ * FIFO list for each priority level, with a bitmask of non-empty levels,
+ * so pushing and popping is O(1).
+ */
+typedef struct {
+	Strand *head[STRAND_PRIORITY_COUNT];
+	Strand *tail[STRAND_PRIORITY_COUNT];
+	uint64_t mask;
+	Strand **heap;
+	size_t nheap, heap_size;
+	int mode;
+} Ready;
+
+/**
+ * Time slice state of a thread
+ *
+ * The slice starts each time the scheduler resumes a coroutine. In timer
+ * mode, `expired` is set asynchronously by a signal instead of comparing
+ * timestamps on each check.
+ */
+typedef struct {
+	uint64_t ticks, start;
+	Strand *running;
+	volatile sig_atomic_t expired;
+	bool timed;
+#if STRAND_LINUX
+	timer_t timer;
+#endif
+	StrandBudgetStats stats;
+} Budget;
+
+/**
+ * Coroutines interleaved by `strand_group_run`
+ *
+ * The live members are kept in the first `n` entries of the list, and `pos`
+ * is the index of the member that runs next or is running.
+ */
+typedef struct {
+	Strand **list;
+	size_t n, pos;
+} Group;
+
 typedef union {
 	int64_t value;
 	struct {
@@ -135,10 +365,53 @@ typedef union {
 	} cfg;
 } StrandConfig;
 
-static __thread Strand top = { .state = CURRENT };
-static __thread Strand *current = NULL;
+__thread Strand strand_tls_top
+	__attribute__ ((tls_model ("initial-exec"))) = { .state = CURRENT };
+__thread Strand *strand_tls_current
+	__attribute__ ((tls_model ("initial-exec"))) = NULL;
 static __thread Strand *dead = NULL;
 static __thread StrandDefer *pool = NULL;
+static __thread size_t dead_count = 0, dead_bytes = 0, pool_count = 0;
+static __thread bool thread_owned = false;
+static __thread Ready ready = { .mode = STRAND_SCHED_FIFO };
+static __thread Budget budget;
+static __thread Group *group = NULL;
+
+static __thread Capture **captures = NULL;
+static __thread uint32_t color_tick = 0;
+
+/**
+ * Shared lock-free caches of dead mapping batches for each NUMA node
+ */
+static struct {
+	uint64_t top;
+	size_t bytes;
+} shared[NODE_MAX];
+
+static uint64_t spare = 0;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static uint32_t capture_rate = 1;
+
+/**
+ * Destructors of coroutine-local keys
+ *
+ * Keys are never deleted. Creation is serialized by `local_lock`, and the
+ * count is published after the destructor is stored, so a key below the
+ * count always has its destructor in place.
+ */
+static void (*local_dtors[STRAND_LOCAL_MAX]) (void *);
+static unsigned local_keys = 0;
+static pthread_mutex_t local_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Registry of every mapping in the process
+ *
+ * Mappings are only linked and unlinked when they are mapped or unmapped,
+ * so this is kept off of the create and free paths when stacks are reused.
+ */
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+static Strand maps = { .map_next = &maps, .map_prev = &maps };
 
 static StrandConfig config = {
 	.cfg = {
@@ -167,355 +440,1822 @@ config_make (uint32_t stack_size, uint32_t flags)
 	return (StrandConfig) {
 		.cfg = {
 			.stack_size = stack_size,
-			.flags = flags & 0x7fffffff
+			.flags = flags & FLAGS_USER
 		}
 	};
 }
 
+#if STRAND_LINUX
+
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static uint8_t *numa_cpus = NULL;
+static int numa_ncpus = 0;
+
 /**
- * Reclaims a "freed" mapping
- *
- * If the map size doesn't meet needs it is unmapped and `NULL` is
- * returned. This will not iterate through the dead list as that could be
- * too costly. Perhaps trying a few at a time would be preferrable though?
+ * Loads the CPU to NUMA node table from sysfs
  *
- * @param  map_size  minimum size requirement for the entire mapping
- * @return  pointer to mapped region or `NULL` if nothing to revive
+ * If the topology cannot be read, every CPU is considered to be on node 0.
  */
-static uint8_t *
-map_revive (uint32_t *map_size)
+static void
+numa_load (void)
 {
-	Strand *s = dead;
-	if (s == NULL) {
-		return NULL;
+	long n = sysconf (_SC_NPROCESSORS_CONF);
+	if (n <= 0 || (numa_cpus = calloc (n, 1)) == NULL) {
+		return;
 	}
+	numa_ncpus = (int)n;
+
+	for (int node = 1; node < NODE_MAX; node++) {
+		char path[64];
+		snprintf (path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *f = fopen (path, "r");
+		if (f == NULL) {
+			continue;
+		}
 
-	uint8_t *map = MAP_BEGIN (s);
-
-	dead = s->parent;
-	if (s->map_size < *map_size) {
-		munmap (map, s->map_size);
-		map = NULL;
-	}
-	else {
-		*map_size = s->map_size;
+		int lo, hi;
+		while (fscanf (f, "%d", &lo) == 1) {
+			hi = lo;
+			int c = fgetc (f);
+			if (c == '-') {
+				if (fscanf (f, "%d", &hi) != 1) {
+					break;
+				}
+				c = fgetc (f);
+			}
+			for (int cpu = lo; cpu <= hi && cpu < numa_ncpus; cpu++) {
+				numa_cpus[cpu] = node;
+			}
+			if (c != ',') {
+				break;
+			}
+		}
+		fclose (f);
 	}
-
-	return map;
 }
 
 /**
- * Reclaims or creates a new mapping
+ * Gets the NUMA node of the CPU the calling thread is running on
  *
- * @param  map_size  minimum size requirement for the entire mapping
- * @return  pointer to mapped region or `NULL` on error
+ * @return  node index
  */
-static uint8_t *
-map_alloc (uint32_t *map_size)
+static int
+numa_node (void)
 {
-	uint8_t *map = map_revive (map_size);
-	if (map == NULL) {
-		map = mmap (NULL, *map_size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|MAP_STACK, -1, 0);
-		if (map == MAP_FAILED) {
-			map = NULL;
-		}
-	}
-	return map;
+	pthread_once (&numa_once, numa_load);
+	int cpu = sched_getcpu ();
+	return cpu >= 0 && cpu < numa_ncpus ? numa_cpus[cpu] : 0;
 }
 
+/**
+ * Sets the memory policy of a mapping to prefer a NUMA node
+ *
+ * Pages that have already been touched on another node are migrated. This
+ * is a hint, so failures are ignored.
+ *
+ * @param  map       mapped address
+ * @param  map_size  size of the mapping
+ * @param  node      node index
+ */
 static void
-defer_run (StrandDefer **d)
+numa_bind (uint8_t *map, uint32_t map_size, int node)
 {
-	assert (d != NULL);
+	unsigned long mask = 1UL << node;
+	syscall (SYS_mbind, map, map_size, MPOL_PREFERRED, &mask, NODE_MAX, MPOL_MF_MOVE);
+}
 
-	StrandDefer *def = *d;
-	*d = NULL;
+#else
 
-	while (def) {
-		StrandDefer *next = def->next;
-		def->fn (def->data);
-		def->next = pool;
-		pool = def;
-		def = next;
-	}
+# define numa_node() 0
+# define numa_bind(map, map_size, node) ((void)0)
+
+#endif
+
+/**
+ * Pushes a batch onto a lock-free stack
+ *
+ * @param  stack  tagged stack head
+ * @param  b      batch descriptor
+ */
+static void
+batch_push (uint64_t *stack, CacheBatch *b)
+{
+	uint64_t old, new;
+	do {
+		old = __atomic_load_n (stack, __ATOMIC_ACQUIRE);
+		b->next = TAG_PTR (old);
+		new = TAG_MAKE (b, old);
+	} while (!__sync_bool_compare_and_swap (stack, old, new));
 }
 
 /**
- * Entry point for a new coroutine
+ * Pops a batch from a lock-free stack
  *
- * This runs the user function, kills the coroutine, and restores the
- * parent context.
+ * @param  stack  tagged stack head
+ * @return  batch descriptor or `NULL` if empty
+ */
+static CacheBatch *
+batch_pop (uint64_t *stack)
+{
+	uint64_t old, new;
+	CacheBatch *b;
+	do {
+		old = __atomic_load_n (stack, __ATOMIC_ACQUIRE);
+		if ((b = TAG_PTR (old)) == NULL) {
+			return NULL;
+		}
+		new = TAG_MAKE (__atomic_load_n (&b->next, __ATOMIC_RELAXED), old);
+	} while (!__sync_bool_compare_and_swap (stack, old, new));
+	return b;
+}
+
+static void map_free (Strand *s);
+
+/**
+ * Moves a list of dead mappings into the shared caches of their nodes
  *
- * @param  s   coroutine pointer
- * @param  fn  function for the body of the coroutine
+ * The list is split into one batch for each node present. If a batch
+ * descriptor cannot be allocated, the mappings are unmapped instead.
+ *
+ * @param  list  dead coroutines linked through `parent`
  */
 static void
-entry (Strand *s, uintptr_t (*fn)(void *, uintptr_t))
+cache_spill (Strand *list)
 {
-	Strand *parent = s->parent;
-	uintptr_t val = fn (s->data, s->value);
+	while (list != NULL) {
+		int node = list->node;
+		Strand *rest = NULL, **tail = &rest;
 
-	current = parent;
+		CacheBatch *b = batch_pop (&spare);
+		if (b == NULL) {
+			b = malloc (sizeof (*b));
+		}
+		if (b != NULL) {
+			b->head = b->tail = NULL;
+			b->count = b->bytes = 0;
+		}
 
-	s->parent = NULL;
-	s->value = val;
-	s->state = DEAD;
-	parent->state = CURRENT;
-	defer_run (&s->defer);
-	strand_ctx_swap (s->ctx, parent->ctx);
+		while (list != NULL) {
+			Strand *s = list;
+			list = s->parent;
+			if (s->node != node) {
+				*tail = s;
+				tail = &s->parent;
+			}
+			else if (b == NULL) {
+				map_free (s);
+			}
+			else {
+				s->parent = b->head;
+				b->head = s;
+				if (b->tail == NULL) {
+					b->tail = s;
+				}
+				b->count++;
+				b->bytes += s->map_size;
+			}
+		}
+		*tail = NULL;
+
+		if (b != NULL) {
+			__sync_fetch_and_add (&shared[node].bytes, b->bytes);
+			batch_push (&shared[node].top, b);
+		}
+		list = rest;
+	}
 }
 
 /**
- * Maps a new stack and coroutine region
- *
- * The mapping is a single contiguous region with the coroutine state struct
- * stored at the end and the stack is position just below. If the stack is
- * protected, the last page will be locked. Currently, only stacks that grow
- * down are supported, but this is pretty trivial to accomodate.
- *
- * For downward growing stacks, the mapping layout looks like:
+ * Moves a batch from the shared cache of a node into the thread cache
  *
- *     +--------+--------------------+--------+
- *     |  lock  | stack              | strand |
- *     +--------+--------------------+--------+
+ * @param  node  NUMA node index
+ * @return  `true` if any mappings were added
+ */
+static bool
+cache_refill (int node)
+{
+	if (__atomic_load_n (&shared[node].top, __ATOMIC_RELAXED) == 0) {
+		return false;
+	}
+
+	CacheBatch *b = batch_pop (&shared[node].top);
+	if (b == NULL) {
+		return false;
+	}
+
+	__sync_fetch_and_sub (&shared[node].bytes, b->bytes);
+	b->tail->parent = dead;
+	dead = b->head;
+	dead_count += b->count;
+	dead_bytes += b->bytes;
+
+	batch_push (&spare, b);
+	return true;
+}
+
+/**
+ * Moves the oldest mappings of the thread cache to the shared caches
+ */
+static void
+cache_trim (void)
+{
+	Strand **p = &dead;
+	for (size_t i = 0; i < STRAND_CACHE_MAX - CACHE_BATCH; i++) {
+		p = &(*p)->parent;
+	}
+
+	Strand *rest = *p;
+	*p = NULL;
+	for (Strand *s = rest; s != NULL; s = s->parent) {
+		dead_count--;
+		dead_bytes -= s->map_size;
+	}
+	cache_spill (rest);
+}
+
+/**
+ * Releases a reference to a creation backtrace
  *
- * For upward growing stack, the mapping looks like:
+ * @param  c  capture or `NULL`
+ */
+static void
+capture_release (Capture *c)
+{
+	if (c != NULL && __sync_sub_and_fetch (&c->refs, 1) == 0) {
+		free (c->symbols);
+		free (c);
+	}
+}
+
+/**
+ * Hands the caches of an exiting thread back
  *
- *     +--------+--------------------+--------+
- *     | strand | stack              |  lock  |
- *     +--------+--------------------+--------+
+ * Dead mappings are moved to the shared caches, pooled defer objects are
+ * freed, and the thread's references to creation backtraces are released.
  *
- * @param  cfg   configuration struct value
- * @param  fn    function for the body of the coroutine
- * @param  data  user data pointer
- * @return  initialized coroutine pointer
+ * @param  data  unused key value
  */
-static Strand *
-new (StrandConfig cfg, uintptr_t (*fn)(void *, uintptr_t), void *data)
+static void
+thread_release (void *data)
 {
-	const int page_size = STRAND_PAGESIZE;
-	// round to nearest page with additional page to accomodate the strand object
-	uint32_t map_size = (((cfg.cfg.stack_size - 1) / page_size) + 2) * page_size;
-	uint8_t *map = NULL, *stack = NULL;
-	Strand *s = NULL;
+	(void)data;
 
-	if (cfg.cfg.flags & STRAND_FPROTECT) {
-		map_size += page_size;
+	Strand *list = dead;
+	dead = NULL;
+	dead_count = dead_bytes = 0;
+	cache_spill (list);
+
+	while (pool != NULL) {
+		StrandDefer *next = pool->next;
+		free (pool);
+		pool = next;
 	}
-	
-	map = map_alloc (&map_size);
-	if (map == NULL) {
-		return NULL;
+	pool_count = 0;
+
+	free (ready.heap);
+	ready.heap = NULL;
+	ready.nheap = ready.heap_size = 0;
+
+	if (captures != NULL) {
+		for (size_t i = 0; i < CAPTURE_BUCKETS; i++) {
+			Capture *c = captures[i];
+			while (c != NULL) {
+				Capture *next = c->next;
+				capture_release (c);
+				c = next;
+			}
+		}
+		free (captures);
+		captures = NULL;
 	}
 
-#if STACK_GROWS_UP
-	stack = map + sizeof (Strand);
-	s = (Strand *)map;
-#else
+#if STRAND_LINUX
+	if (budget.timed) {
+		timer_delete (budget.timer);
+		budget.timed = false;
+	}
+#endif
+}
+
+static void
+thread_key_create (void)
+{
+	pthread_key_create (&thread_key, thread_release);
+}
+
+/**
+ * Ensures the thread's caches are released when it exits
+ *
+ * This must be called before a thread first holds on to any resources.
+ */
+static inline void
+thread_own (void)
+{
+	if (__builtin_expect (!thread_owned, 0)) {
+		pthread_once (&thread_once, thread_key_create);
+		pthread_setspecific (thread_key, &thread_owned);
+		thread_owned = true;
+	}
+}
+
+/**
+ * Adds a dead mapping to the thread cache
+ *
+ * @param  s  dead coroutine
+ */
+static void
+cache_push (Strand *s)
+{
+	thread_own ();
+
+	s->parent = dead;
+	dead = s;
+	dead_count++;
+	dead_bytes += s->map_size;
+
+	if (dead_count > STRAND_CACHE_MAX) {
+		cache_trim ();
+	}
+}
+
+#if STRAND_EXECINFO
+
+static __thread uint32_t capture_tick = 0;
+
+/**
+ * Captures the backtrace of the calling thread
+ *
+ * Identical backtraces are shared through a per-thread hash table, so
+ * repeated creation from the same call site only costs the unwind, a hash
+ * and a compare. When a capture rate is set, only one in that many calls
+ * captures anything.
+ *
+ * @return  referenced capture or `NULL`
+ */
+static Capture *
+capture_new (void)
+{
+	uint32_t rate = __atomic_load_n (&capture_rate, __ATOMIC_RELAXED);
+	if (rate > 1 && ++capture_tick % rate != 0) {
+		return NULL;
+	}
+
+	void *frames[CAPTURE_DEPTH];
+	int n = backtrace (frames, CAPTURE_DEPTH);
+	if (n <= 0) {
+		return NULL;
+	}
+
+	// FNV-1a over the return addresses
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for (int i = 0; i < n; i++) {
+		hash = (hash ^ (uintptr_t)frames[i]) * UINT64_C(0x100000001b3);
+	}
+
+	if (captures == NULL) {
+		thread_own ();
+		captures = calloc (CAPTURE_BUCKETS, sizeof (*captures));
+		if (captures == NULL) {
+			return NULL;
+		}
+	}
+
+	Capture **bucket = &captures[hash % CAPTURE_BUCKETS];
+	for (Capture *c = *bucket; c != NULL; c = c->next) {
+		if (c->hash == hash && c->nframes == n &&
+				memcmp (c->frames, frames, n * sizeof (frames[0])) == 0) {
+			__sync_fetch_and_add (&c->refs, 1);
+			return c;
+		}
+	}
+
+	Capture *c = malloc (sizeof (*c) + n * sizeof (frames[0]));
+	if (c == NULL) {
+		return NULL;
+	}
+
+	memcpy (c->frames, frames, n * sizeof (frames[0]));
+	c->hash = hash;
+	c->refs = 2;
+	c->symbols = NULL;
+	c->nframes = n;
+	c->next = *bucket;
+	*bucket = c;
+	return c;
+}
+
+#else
+
+# define capture_new() NULL
+
+#endif
+
+/**
+ * Prints a creation backtrace, resolving symbols on first use
+ *
+ * @param  c       capture or `NULL`
+ * @param  out     output `FILE *` object
+ * @param  indent  prefix for each frame
+ */
+static void __attribute__ ((cold))
+capture_print (Capture *c, FILE *out, const char *indent)
+{
+	if (c == NULL) {
+		return;
+	}
+
+#if STRAND_EXECINFO
+	char **symbols = __atomic_load_n (&c->symbols, __ATOMIC_ACQUIRE);
+	if (symbols == NULL) {
+		symbols = backtrace_symbols (c->frames, c->nframes);
+		if (symbols != NULL &&
+				!__sync_bool_compare_and_swap (&c->symbols, NULL, symbols)) {
+			free (symbols);
+			symbols = c->symbols;
+		}
+	}
+	if (symbols != NULL) {
+		for (int i = 0; i < c->nframes; i++) {
+			fprintf (out, "%s%s\n", indent, symbols[i]);
+		}
+		return;
+	}
+#endif
+
+	for (int i = 0; i < c->nframes; i++) {
+		fprintf (out, "%s0x%" PRIxPTR "\n", indent, (uintptr_t)c->frames[i]);
+	}
+}
+
+/**
+ * Prints an error and the state of a coroutine, then aborts
+ *
+ * @param  s    coroutine pointer or `NULL`
+ * @param  fmt  printf-style format of the error
+ * @param  ...  format arguments
+ */
+static void __attribute__ ((cold, noinline, noreturn, format (printf, 2, 3)))
+ensure_fail (const Strand *s, const char *fmt, ...)
+{
+	va_list ap;
+	va_start (ap, fmt);
+	vfprintf (stderr, fmt, ap);
+	va_end (ap);
+
+	if (s != NULL) {
+		fprintf (stderr, " (" FMT ")\n", FMTARGS (s));
+		capture_print (s->capture, stderr, "\t");
+	}
+	else {
+		fprintf (stderr, "\n");
+	}
+	fflush (stderr);
+	abort ();
+}
+
+/**
+ * Adds a new mapping to the registry
+ *
+ * @param  s  coroutine in the mapping
+ */
+static void
+map_link (Strand *s)
+{
+	pthread_mutex_lock (&maps_lock);
+	s->map_next = &maps;
+	s->map_prev = maps.map_prev;
+	s->map_prev->map_next = s;
+	maps.map_prev = s;
+	pthread_mutex_unlock (&maps_lock);
+}
+
+/**
+ * Removes a mapping from the registry and unmaps it
+ *
+ * @param  s  coroutine in the mapping
+ */
+static void
+map_free (Strand *s)
+{
+	uint8_t *map = MAP_BEGIN (s);
+	uint32_t map_size = s->map_size;
+
+	pthread_mutex_lock (&maps_lock);
+	s->map_prev->map_next = s->map_next;
+	s->map_next->map_prev = s->map_prev;
+	pthread_mutex_unlock (&maps_lock);
+
+	munmap (map, map_size);
+}
+
+/**
+ * Reclaims a "freed" mapping
+ *
+ * The thread's own cache is used if the mapping at its head belongs to the
+ * requested node. Otherwise, a batch is first moved over from the node's
+ * shared cache.
+ *
+ * If the map size doesn't meet needs it is unmapped and `NULL` is
+ * returned. This will not iterate through the dead list as that could be
+ * too costly. Perhaps trying a few at a time would be preferrable though?
+ *
+ * @param  map_size  minimum size requirement for the entire mapping
+ * @param  color     receives the offset of the coroutine in the mapping
+ * @param  node      NUMA node for the mapping
+ * @return  pointer to mapped region or `NULL` if nothing to revive
+ */
+static uint8_t *
+map_revive (uint32_t *map_size, uint32_t *color, int node)
+{
+	Strand *s = dead;
+	if (s == NULL || s->node != node) {
+		if (!cache_refill (node)) {
+			return NULL;
+		}
+		s = dead;
+	}
+
+	dead = s->parent;
+	dead_count--;
+	dead_bytes -= s->map_size;
+
+	uint8_t *map = MAP_BEGIN (s);
+
+	if (s->map_size < *map_size) {
+		map_free (s);
+		map = NULL;
+	}
+	else {
+		*map_size = s->map_size;
+		*color = s->color;
+	}
+
+	return map;
+}
+
+/**
+ * Picks the offset of the coroutine from the end of a new mapping
+ *
+ * Without an offset, the top of every stack and every coroutine object
+ * would share a page offset, so they would compete for the same cache
+ * sets. Offsets rotate through multiples of `STRAND_COLOR_STEP` within the
+ * extra space of the last page, so the usable stack is never smaller than
+ * requested.
+ *
+ * @return  byte offset
+ */
+static uint32_t
+color_pick (void)
+{
+	const uint32_t colors = (STRAND_PAGESIZE - sizeof (Strand)) / STRAND_COLOR_STEP + 1;
+	return (color_tick++ % colors) * STRAND_COLOR_STEP;
+}
+
+/**
+ * Reclaims or creates a new mapping
+ *
+ * Reused mappings keep the offset of the coroutine they were created with.
+ *
+ * @param  map_size  minimum size requirement for the entire mapping
+ * @param  color     receives the offset of the coroutine in the mapping
+ * @param  flags     configuration flags
+ * @param  node      NUMA node for the mapping
+ * @return  pointer to mapped region or `NULL` on error
+ */
+static uint8_t *
+map_alloc (uint32_t *map_size, uint32_t *color, uint32_t flags, int node)
+{
+	uint8_t *map = map_revive (map_size, color, node);
+	if (map == NULL) {
+		map = mmap (NULL, *map_size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|MAP_STACK, -1, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+		}
+		*color = (flags & STRAND_FCOLOR) ? color_pick () : 0;
+	}
+	return map;
+}
+
+static void
+defer_run (StrandDefer **d)
+{
+	assert (d != NULL);
+
+	StrandDefer *def = *d;
+	*d = NULL;
+
+	while (def) {
+		StrandDefer *next = def->next;
+		def->fn (def->data);
+		def->next = pool;
+		pool = def;
+		pool_count++;
+		def = next;
+	}
+}
+
+/**
+ * Runs the destructors of the coroutine-local values of a coroutine
+ *
+ * Each value is cleared before its destructor is invoked, and the spill
+ * table is released.
+ *
+ * @param  s  coroutine pointer
+ */
+static void
+local_run (Strand *s)
+{
+	unsigned n = __atomic_load_n (&local_keys, __ATOMIC_ACQUIRE);
+	if (n == 0) {
+		return;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		void **slot = i < STRAND_LOCAL_INLINE ?
+			&s->locals[i] :
+			(s->locals_more ? &s->locals_more[i - STRAND_LOCAL_INLINE] : NULL);
+		if (slot == NULL) {
+			break;
+		}
+		void *val = *slot;
+		if (val != NULL) {
+			*slot = NULL;
+			if (local_dtors[i] != NULL) {
+				local_dtors[i] (val);
+			}
+		}
+	}
+
+	free (s->locals_more);
+	s->locals_more = NULL;
+}
+
+/**
+ * Entry point for a new coroutine
+ *
+ * This runs the user function, kills the coroutine, and restores the
+ * parent context.
+ *
+ * @param  s   coroutine pointer
+ * @param  fn  function for the body of the coroutine
+ */
+static void
+entry (Strand *s, uintptr_t (*fn)(void *, uintptr_t))
+{
+	uintptr_t val = fn (s->data, s->value);
+
+	// the coroutine may have been resumed from a different thread, so the
+	// parent must be loaded after the function has returned
+	Strand *parent = s->parent;
+	strand_tls_current = parent;
+
+	s->parent = NULL;
+	s->value = val;
+	s->state = DEAD;
+	parent->state = CURRENT;
+	defer_run (&s->defer);
+	local_run (s);
+	trace (TRACE_DEAD, s, TRACE_ID (parent));
+	perf_switch (s->perf);
+	strand_ctx_swap (s->ctx, parent->ctx);
+}
+
+/**
+ * Faults in the pages at the top of a stack
+ *
+ * Cached mappings are never released back to the system, so the pages stay
+ * resident when the mapping is reused. The page holding the coroutine
+ * object is always resident and is not written.
+ *
+ * @param  map       mapped address
+ * @param  map_size  size of the mapping
+ */
+static void
+map_prefault (uint8_t *map, uint32_t map_size)
+{
+	const uint32_t page_size = STRAND_PAGESIZE;
+	uint32_t len = ((STRAND_PREFAULT_SIZE + page_size - 1) / page_size) * page_size;
+	if (len > map_size - 2*page_size) {
+		len = map_size - 2*page_size;
+	}
+
+#if STACK_GROWS_UP
+	uint8_t *begin = map + page_size;
+#else
+	uint8_t *begin = map + map_size - page_size - len;
+#endif
+
+#if defined (MADV_POPULATE_WRITE)
+	if (madvise (begin, len, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+	for (uint32_t off = 0; off < len; off += page_size) {
+		((volatile uint8_t *)begin)[off] = 0;
+	}
+}
+
+/**
+ * Maps a new stack and coroutine region
+ *
+ * The mapping is a single contiguous region with the coroutine state struct
+ * stored at the end and the stack is position just below. If the stack is
+ * protected, the last page will be locked. Currently, only stacks that grow
+ * down are supported, but this is pretty trivial to accomodate.
+ *
+ * For downward growing stacks, the mapping layout looks like:
+ *
+ *     +--------+--------------------+--------+
+ *     |  lock  | stack              | strand |
+ *     +--------+--------------------+--------+
+ *
+ * For upward growing stack, the mapping looks like:
+ *
+ *     +--------+--------------------+--------+
+ *     | strand | stack              |  lock  |
+ *     +--------+--------------------+--------+
+ *
+ * @param  cfg   configuration struct value
+ * @param  fn    function for the body of the coroutine
+ * @param  data  user data pointer
+ * @param  site  return address of the creating call
+ * @return  initialized coroutine pointer
+ */
+static Strand *
+new (StrandConfig cfg, uintptr_t (*fn)(void *, uintptr_t), void *data,
+		const void *site)
+{
+	const int page_size = STRAND_PAGESIZE;
+	// round to nearest page with additional page to accomodate the strand object
+	uint32_t map_size = (((cfg.cfg.stack_size - 1) / page_size) + 2) * page_size;
+	uint8_t *map = NULL, *stack = NULL;
+	uint32_t color = 0;
+	Strand *s = NULL;
+
+	if (cfg.cfg.flags & STRAND_FPROTECT) {
+		map_size += page_size;
+	}
+
+	int node = (cfg.cfg.flags & STRAND_FNUMA) ? numa_node () : 0;
+
+	map = map_alloc (&map_size, &color, cfg.cfg.flags, node);
+	if (map == NULL) {
+		return NULL;
+	}
+
+#if STACK_GROWS_UP
+	stack = map + color + sizeof (Strand);
+	s = (Strand *)(map + color);
+#else
 	stack = map;
-	s = (Strand *)(map + map_size - sizeof (Strand));
+	s = (Strand *)(map + map_size - sizeof (Strand) - color);
+#endif
+
+	// fresh mappings are zeroed, and registered mappings are never unlinked
+	if (s->map_prev == NULL) {
+		s->map_size = map_size;
+		s->color = color;
+		map_link (s);
+	}
+
+	if ((cfg.cfg.flags & STRAND_FPROTECT) && !(s->flags & STRAND_FPROTECT)) {
+#if STACK_GROWS_UP
+		int rc = mprotect (map+map_size-page_size, page_size, PROT_NONE);
+#else
+		int rc = mprotect (map, page_size, PROT_NONE);
+#endif
+		if (rc < 0) {
+			int err = errno;
+			map_free (s);
+			errno = err;
+			return NULL;
+		}
+	}
+
+	// bind before the stack is touched so pages fault in on the local node
+	if ((cfg.cfg.flags & STRAND_FNUMA) && !(s->flags & STRAND_FNUMA)) {
+		numa_bind (map, map_size, node);
+	}
+
+	if ((cfg.cfg.flags & STRAND_FPREFAULT) && !(s->flags & STRAND_FPREFAULT)) {
+		map_prefault (map, map_size);
+	}
+
+	s->parent = NULL;
+	s->data = data;
+	s->value = 0;
+	s->defer = NULL;
+	s->task = NULL;
+	s->site = site;
+	s->capture = NULL;
+	s->map_size = map_size;
+	s->state = SUSPENDED;
+	s->flags = cfg.cfg.flags;
+	s->node = node;
+	s->priority = STRAND_PRIORITY_DEFAULT;
+	s->deadline = 0;
+	s->ready_next = NULL;
+	memset (s->locals, 0, sizeof (s->locals));
+	s->locals_more = NULL;
+	memset (s->perf, 0, sizeof (s->perf));
+#if STRAND_VALGRIND
+	s->stack_id = VALGRIND_STACK_REGISTER (map, STACK_SIZE (s));
+#endif
+
+	strand_ctx_init (s->ctx, stack, STACK_SIZE (s),
+			(uintptr_t)entry, (uintptr_t)s, (uintptr_t)fn);
+
+	if (cfg.cfg.flags & STRAND_FCAPTURE) {
+		s->capture = capture_new ();
+	}
+
+	return s;
+}
+
+
+
+void
+strand_configure (uint32_t stack_size, uint32_t flags)
+{
+	StrandConfig c = config_make (stack_size, flags);
+	while (!__sync_bool_compare_and_swap (&config.value, config.value, c.value));
+}
+
+Strand *
+strand_new (uintptr_t (*fn)(void *, uintptr_t), void *data)
+{
+	assert (fn != NULL);
+
+	return new (config, fn, data, __builtin_return_address (0));
+}
+
+Strand *
+strand_new_config (uint32_t stack_size, uint32_t flags,
+		uintptr_t (*fn)(void *, uintptr_t), void *data)
+{
+	assert (fn != NULL);
+
+	return new (config_make (stack_size, flags), fn, data,
+			__builtin_return_address (0));
+}
+
+void
+strand_reset (Strand *s, uintptr_t (*fn)(void *, uintptr_t), void *data)
+{
+	assert (fn != NULL);
+
+	ensure (s, s != NULL, "attempting to reset a null coroutine");
+	ensure (s, s->state == DEAD, "attempting to reset a live coroutine");
+
+	s->data = data;
+	s->value = 0;
+	s->site = __builtin_return_address (0);
+	capture_release (s->capture);
+	s->capture = (s->flags & STRAND_FCAPTURE) ? capture_new () : NULL;
+	s->state = SUSPENDED;
+	s->flags &= ~STRAND_FSPAWN;
+	s->priority = STRAND_PRIORITY_DEFAULT;
+	s->deadline = 0;
+	memset (s->perf, 0, sizeof (s->perf));
+
+	strand_ctx_init (s->ctx, STACK_BEGIN (s), STACK_SIZE (s),
+			(uintptr_t)entry, (uintptr_t)s, (uintptr_t)fn);
+}
+
+void
+strand_free (Strand **sp)
+{
+	assert (sp != NULL);
+
+	Strand *s = *sp;
+	if (s == NULL) { return; }
+
+	ensure (s, s->state != CURRENT, "attempting to free current coroutine");
+	ensure (s, s->state != ACTIVE, "attempting to free an active coroutine");
+	ensure (s, !(s->flags & STRAND_FQUEUED), "attempting to free a ready coroutine");
+
+	*sp = NULL;
+
+	trace (TRACE_FREE, s, NULL);
+	defer_run (&s->defer);
+	local_run (s);
+	capture_release (s->capture);
+	s->capture = NULL;
+
+#if STRAND_VALGRIND
+	VALGRIND_STACK_DEREGISTER (s->stack_id);
+#endif
+
+	// coroutines may migrate, so hand remote mappings back to their node
+	if ((s->flags & STRAND_FNUMA) && s->node != numa_node ()) {
+		s->parent = NULL;
+		cache_spill (s);
+		return;
+	}
+
+	cache_push (s);
+}
+
+uintptr_t
+strand_yield (uintptr_t val)
+{
+	Strand *s = strand_tls_current, *p = s->parent;
+
+	ensure (s, p != NULL, "yield attempted outside of coroutine");
+
+	strand_tls_current = p;
+
+	s->parent = NULL;
+	s->value = val;
+	s->state = SUSPENDED;
+	p->state = CURRENT;
+	trace (TRACE_YIELD, s, TRACE_ID (p));
+	perf_switch (s->perf);
+	strand_ctx_swap (s->ctx, p->ctx);
+	return s->value;
+}
+
+uintptr_t
+strand_resume (Strand *s, uintptr_t val)
+{
+	ensure (s, s != NULL, "attempting to resume a null coroutine");
+	ensure (s, s->state != CURRENT, "attempting to resume the current coroutine");
+	ensure (s, s->state != ACTIVE, "attempting to resume an active coroutine");
+	ensure (s, s->state != DEAD, "attempting to resume a dead coroutine");
+
+	Strand *p = strand_tls_current;
+	if (p == NULL) {
+		p = &strand_tls_top;
+	}
+
+	strand_tls_current = s;
+
+	s->parent = p;
+	s->value = val;
+	s->state = CURRENT;
+	p->state = ACTIVE;
+	trace (TRACE_RESUME, TRACE_ID (p), s);
+	perf_switch (p->perf);
+	strand_ctx_swap (p->ctx, s->ctx);
+
+	return s->value;
+}
+
+void
+strand_prefetch_yield (const void *addr)
+{
+	__builtin_prefetch (addr);
+
+	Group *g = group;
+	Strand *s = strand_tls_current;
+	if (g == NULL || s != g->list[g->pos] ||
+			strand_trace_active || strand_perf_active) {
+		strand_yield (0);
+		return;
+	}
+	if (g->n == 1) {
+		return;
+	}
+
+	// switch to the next member in place of this one, so the parent stays
+	// active and is not switched through
+	size_t next = g->pos + 1 < g->n ? g->pos + 1 : 0;
+	Strand *t = g->list[next];
+	if (t->state != SUSPENDED) {
+		// the driver drops members that have died since the group started
+		strand_yield (0);
+		return;
+	}
+	g->pos = next;
+
+	strand_tls_current = t;
+
+	t->parent = s->parent;
+	t->value = 0;
+	t->state = CURRENT;
+	s->parent = NULL;
+	s->value = 0;
+	s->state = SUSPENDED;
+	strand_ctx_swap (s->ctx, t->ctx);
+}
+
+void
+strand_group_run (Strand **list, size_t n)
+{
+	assert (list != NULL || n == 0);
+
+	// only suspended members may be switched to, so dead ones are moved to
+	// the end before starting
+	for (size_t i = 0; i < n; ) {
+		Strand *s = list[i];
+		ensure (s, s != NULL, "attempting to run a null coroutine in a group");
+		ensure (s, s->state != CURRENT && s->state != ACTIVE,
+				"attempting to run a running coroutine in a group");
+		if (s->state == DEAD) {
+			list[i] = list[--n];
+			list[n] = s;
+		}
+		else {
+			i++;
+		}
+	}
+
+	Group g = { .list = list, .n = n, .pos = 0 }, *saved = group;
+	group = &g;
+
+	while (g.n > 0) {
+		if (g.pos >= g.n) {
+			g.pos = 0;
+		}
+
+		Strand *s = list[g.pos];
+		if (s->state != DEAD) {
+			// this returns once whichever member is running yields
+			// normally or returns
+			strand_resume (s, 0);
+			s = list[g.pos];
+		}
+
+		if (s->state == DEAD) {
+			list[g.pos] = list[--g.n];
+			list[g.n] = s;
+		}
+		else {
+			g.pos++;
+		}
+	}
+
+	group = saved;
+}
+
+size_t
+strand_resume_batch (Strand **list, size_t n, uintptr_t *results)
+{
+	assert (list != NULL || n == 0);
+
+	size_t d = STRAND_BATCH_PREFETCH, count = 0;
+
+	// warm up the pipeline for the first entries
+	for (size_t i = 0; i < n && i < 2 * d; i++) {
+		if (list[i] != NULL) {
+			__builtin_prefetch (list[i], 1);
+		}
+	}
+	for (size_t i = 0; i < n && i < d; i++) {
+		if (list[i] != NULL && list[i]->state == SUSPENDED) {
+			strand_ctx_prefetch (list[i]->ctx);
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		// the coroutine `d` ahead was prefetched `d` iterations ago, so its
+		// saved stack pointer can now be read without stalling
+		if (i + 2 * d < n && list[i + 2 * d] != NULL) {
+			__builtin_prefetch (list[i + 2 * d], 1);
+		}
+		if (i + d < n) {
+			Strand *next = list[i + d];
+			if (next != NULL && next->state == SUSPENDED) {
+				strand_ctx_prefetch (next->ctx);
+			}
+		}
+
+		Strand *s = list[i];
+		if (s == NULL || s->state == DEAD) {
+			continue;
+		}
+		uintptr_t val = strand_resume (s, 0);
+		if (results != NULL) {
+			results[i] = val;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+void
+strand_perf (const Strand *s, StrandPerf *perf)
+{
+	assert (s != NULL);
+	assert (perf != NULL);
+
+	perf->instructions = s->perf[0];
+	perf->cycles = s->perf[1];
+	perf->cache_misses = s->perf[2];
+}
+
+bool
+strand_sample (const void **site, uintptr_t *lo, uintptr_t *hi)
+{
+	Strand *s = strand_tls_current;
+	if (s == NULL || s == &strand_tls_top) {
+		return false;
+	}
+
+	*site = s->site;
+	*lo = (uintptr_t)STACK_BEGIN (s);
+	*hi = *lo + STACK_SIZE (s);
+	return true;
+}
+
+void
+strand_capture_rate (uint32_t rate)
+{
+	__atomic_store_n (&capture_rate, rate, __ATOMIC_RELAXED);
+}
+
+int
+strand_numa_node (void)
+{
+	return numa_node ();
+}
+
+int
+strand_pin (int cpu)
+{
+#if STRAND_LINUX
+	cpu_set_t set;
+	CPU_ZERO (&set);
+	CPU_SET (cpu, &set);
+	int rc = pthread_setaffinity_np (pthread_self (), sizeof set, &set);
+	return rc == 0 ? 0 : -rc;
+#else
+	(void)cpu;
+	return -ENOTSUP;
 #endif
+}
+
+/**
+ * Gets the size class index for a mapping size
+ *
+ * @param  map_size  size of the mapping
+ * @return  index into `StrandMemStats.sizes`
+ */
+static int
+memstats_class (uint32_t map_size)
+{
+	int i = 0;
+	while (i < STRAND_MEMSTATS_CLASSES - 1 && map_size > ((uint32_t)STRAND_STACK_MIN << i)) {
+		i++;
+	}
+	return i;
+}
+
+int
+strand_memstats (StrandMemStats *st)
+{
+	assert (st != NULL);
+
+	const size_t page_size = STRAND_PAGESIZE;
+	size_t vec_size = 0;
+	unsigned char *vec = NULL;
+	int rc = 0;
+
+	memset (st, 0, sizeof (*st));
+	for (int i = 0; i < STRAND_MEMSTATS_CLASSES; i++) {
+		st->sizes[i].map_size = (size_t)STRAND_STACK_MIN << i;
+	}
+
+	st->cached = dead_bytes;
+	st->defer = pool_count * sizeof (StrandDefer);
+	for (int i = 0; i < NODE_MAX; i++) {
+		st->shared += __atomic_load_n (&shared[i].bytes, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_lock (&maps_lock);
+	for (Strand *s = maps.map_next; s != &maps; s = s->map_next) {
+		size_t pages = (s->map_size + page_size - 1) / page_size;
+		if (pages > vec_size) {
+			unsigned char *tmp = realloc (vec, pages);
+			if (tmp == NULL) {
+				rc = -errno;
+				break;
+			}
+			vec = tmp;
+			vec_size = pages;
+		}
+
+		size_t resident = 0;
+		if (mincore (MAP_BEGIN (s), s->map_size, (void *)vec) == 0) {
+			for (size_t i = 0; i < pages; i++) {
+				resident += vec[i] & 1;
+			}
+			resident *= page_size;
+		}
+
+		int c = memstats_class (s->map_size);
+		st->sizes[c].count++;
+		st->sizes[c].mapped += s->map_size;
+		st->sizes[c].resident += resident;
+		st->mapped += s->map_size;
+		st->resident += resident;
+	}
+	pthread_mutex_unlock (&maps_lock);
+
+	free (vec);
+	return rc;
+}
+
+Strand *
+strand_current (void)
+{
+	Strand *s = strand_tls_current;
+	return s == &strand_tls_top ? NULL : s;
+}
+
+bool
+strand_alive (const Strand *s)
+{
+	assert (s != NULL);
+
+	return s->state != DEAD;
+}
+
+size_t
+strand_stack_used (const Strand *s)
+{
+	return strand_ctx_stack_size (s->ctx, STACK_BEGIN (s), STACK_SIZE (s), s == strand_tls_current);
+}
+
+int
+strand_defer (void (*fn) (void *), void *data)
+{
+	assert (fn != NULL);
+
+	StrandDefer *def = pool;
+	if (def != NULL) {
+		pool = def->next;
+		pool_count--;
+	}
+	else {
+		def = malloc (sizeof (*def));
+		if (def == NULL) {
+			return -errno;
+		}
+	}
+
+	// calls made while a task function runs on this stack go to the task
+	Strand *s = strand_tls_current;
+	StrandTask *t = s != NULL ? s->task : strand_tls_top.task;
+	StrandDefer **list = t != NULL ? &t->defer : &s->defer;
+
+	def->next = *list;
+	def->fn = fn;
+	def->data = data;
+	*list = def;
+
+	return 0;
+}
+
+void
+strand_task_init (StrandTask *t, uintptr_t (*fn)(StrandTask *, uintptr_t))
+{
+	assert (t != NULL);
+	assert (fn != NULL);
+
+	*t = (StrandTask)STRAND_TASK_INIT (fn);
+}
+
+uintptr_t
+strand_task_resume (StrandTask *t, uintptr_t val)
+{
+	ensure (strand_tls_current, t != NULL, "attempting to resume a null task");
+	ensure (strand_tls_current, t->state != CURRENT, "attempting to resume the current task");
+	ensure (strand_tls_current, t->state != DEAD, "attempting to resume a dead task");
+
+	// the task runs on the stack of the caller, so it is recorded there rather
+	// than per thread, which a coroutine yielding from the task would outlive
+	Strand *s = strand_tls_current != NULL ? strand_tls_current : &strand_tls_top;
+	StrandTask *saved = s->task;
+	s->task = t;
+
+	t->state = CURRENT;
+	val = t->fn (t, val);
+
+	s->task = saved;
+
+	if (t->line == STRAND_TASK_DONE) {
+		t->state = DEAD;
+		defer_run (&t->defer);
+	}
+	else {
+		t->state = SUSPENDED;
+	}
+	return val;
+}
+
+bool
+strand_task_alive (const StrandTask *t)
+{
+	assert (t != NULL);
+
+	return t->state != DEAD;
+}
+
+void
+strand_task_cancel (StrandTask *t)
+{
+	assert (t != NULL);
+
+	ensure (strand_tls_current, t->state != CURRENT, "attempting to cancel the current task");
+
+	if (t->state != DEAD) {
+		t->line = STRAND_TASK_DONE;
+		t->state = DEAD;
+		defer_run (&t->defer);
+	}
+}
+
+static void *
+defer_free (void *val)
+{
+	if (val != NULL && strand_defer (free, val) < 0) {
+		free (val);
+		val = NULL;
+	}
+	return val;
+}
+
+int
+strand_local_key_create (StrandLocalKey *key, void (*dtor)(void *))
+{
+	assert (key != NULL);
 
-	if ((cfg.cfg.flags & STRAND_FPROTECT) && !(s->flags & STRAND_FPROTECT)) {
-#if STACK_GROWS_UP
-		int rc = mprotect (map+map_size-page_size, page_size, PROT_NONE);
-#else
-		int rc = mprotect (map, page_size, PROT_NONE);
-#endif
-		if (rc < 0) {
-			int err = errno;
-			munmap (map, map_size);
-			errno = err;
-			return NULL;
+	pthread_mutex_lock (&local_lock);
+	unsigned n = local_keys;
+	if (n >= STRAND_LOCAL_MAX) {
+		pthread_mutex_unlock (&local_lock);
+		return -EAGAIN;
+	}
+	local_dtors[n] = dtor;
+	__atomic_store_n (&local_keys, n + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock (&local_lock);
+
+	*key = n;
+	return 0;
+}
+
+void *
+strand_local_get (StrandLocalKey key)
+{
+	Strand *s = strand_tls_current;
+	if (s == NULL || s == &strand_tls_top) {
+		return NULL;
+	}
+	if (key >= __atomic_load_n (&local_keys, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	if (key < STRAND_LOCAL_INLINE) {
+		return s->locals[key];
+	}
+	return s->locals_more ? s->locals_more[key - STRAND_LOCAL_INLINE] : NULL;
+}
+
+int
+strand_local_set (StrandLocalKey key, void *val)
+{
+	Strand *s = strand_tls_current;
+	if (s == NULL || s == &strand_tls_top) {
+		return -EPERM;
+	}
+	if (key >= __atomic_load_n (&local_keys, __ATOMIC_ACQUIRE)) {
+		return -EINVAL;
+	}
+	if (key < STRAND_LOCAL_INLINE) {
+		s->locals[key] = val;
+		return 0;
+	}
+	if (s->locals_more == NULL) {
+		if (val == NULL) {
+			return 0;
+		}
+		s->locals_more = calloc (STRAND_LOCAL_MAX - STRAND_LOCAL_INLINE, sizeof (void *));
+		if (s->locals_more == NULL) {
+			return -errno;
 		}
 	}
+	s->locals_more[key - STRAND_LOCAL_INLINE] = val;
+	return 0;
+}
 
-	s->parent = NULL;
-	s->data = data;
-	s->value = 0;
-	s->defer = NULL;
-	s->backtrace = NULL;
-	s->nbacktrace = 0;
-	s->map_size = map_size;
-	s->state = SUSPENDED;
-	s->flags = cfg.cfg.flags;
-#if STRAND_VALGRIND
-	s->stack_id = VALGRIND_STACK_REGISTER (map, STACK_SIZE (s));
-#endif
+void *
+strand_malloc (size_t size)
+{
+	return defer_free (malloc (size));
+}
 
-	strand_ctx_init (s->ctx, stack, STACK_SIZE (s),
-			(uintptr_t)entry, (uintptr_t)s, (uintptr_t)fn);
+void *
+strand_calloc (size_t count, size_t size)
+{
+	return defer_free (calloc (count, size));
+}
 
-#if STRAND_EXECINFO
-	if (cfg.cfg.flags & STRAND_FCAPTURE) {
-		void *calls[32];
-		int frames = backtrace (calls, sizeof calls / sizeof calls[0]);
-		if (frames > 0) {
-			s->backtrace = backtrace_symbols (calls, frames);
-			s->nbacktrace = frames;
+/**
+ * Adds a coroutine to the deadline heap
+ *
+ * @param  s  coroutine with a deadline
+ * @return  0 on success or `-errno` on error
+ */
+static int
+heap_push (Strand *s)
+{
+	if (ready.nheap == ready.heap_size) {
+		thread_own ();
+		size_t size = ready.heap_size ? ready.heap_size * 2 : 64;
+		Strand **heap = realloc (ready.heap, size * sizeof (*heap));
+		if (heap == NULL) {
+			return -errno;
 		}
+		ready.heap = heap;
+		ready.heap_size = size;
 	}
-#endif
 
-	return s;
+	Strand **heap = ready.heap;
+	size_t i = ready.nheap++;
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (heap[parent]->deadline <= s->deadline) {
+			break;
+		}
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = s;
+	return 0;
 }
 
+/**
+ * Removes the coroutine with the earliest deadline
+ *
+ * @return  coroutine or `NULL` if the heap is empty
+ */
+static Strand *
+heap_pop (void)
+{
+	if (ready.nheap == 0) {
+		return NULL;
+	}
+
+	Strand **heap = ready.heap;
+	Strand *top = heap[0], *last = heap[--ready.nheap];
+	size_t i = 0, n = ready.nheap;
+	while (true) {
+		size_t child = 2*i + 1;
+		if (child >= n) {
+			break;
+		}
+		if (child + 1 < n && heap[child + 1]->deadline < heap[child]->deadline) {
+			child++;
+		}
+		if (last->deadline <= heap[child]->deadline) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	if (n > 0) {
+		heap[i] = last;
+	}
+	return top;
+}
 
+/**
+ * Removes the next coroutine to run from the ready queue
+ *
+ * @return  coroutine or `NULL` if nothing is ready
+ */
+static Strand *
+ready_pop (void)
+{
+	Strand *s = heap_pop ();
+	if (s == NULL) {
+		if (ready.mask == 0) {
+			return NULL;
+		}
+		int p = __builtin_ctzll (ready.mask);
+		s = ready.head[p];
+		ready.head[p] = s->ready_next;
+		if (ready.head[p] == NULL) {
+			ready.tail[p] = NULL;
+			ready.mask &= ~(UINT64_C(1) << p);
+		}
+		s->ready_next = NULL;
+	}
+	s->flags &= ~STRAND_FQUEUED;
+	return s;
+}
 
 void
-strand_configure (uint32_t stack_size, uint32_t flags)
+strand_sched_mode (int mode)
 {
-	StrandConfig c = config_make (stack_size, flags);
-	while (!__sync_bool_compare_and_swap (&config.value, config.value, c.value));
+	ready.mode = mode;
 }
 
-Strand *
-strand_new (uintptr_t (*fn)(void *, uintptr_t), void *data)
+void
+strand_set_priority (Strand *s, int priority)
 {
-	assert (fn != NULL);
+	assert (s != NULL);
 
-	return new (config, fn, data);
+	if (priority < 0) {
+		priority = 0;
+	}
+	else if (priority >= STRAND_PRIORITY_COUNT) {
+		priority = STRAND_PRIORITY_COUNT - 1;
+	}
+	s->priority = priority;
 }
 
-Strand *
-strand_new_config (uint32_t stack_size, uint32_t flags,
-		uintptr_t (*fn)(void *, uintptr_t), void *data)
+int
+strand_priority (const Strand *s)
 {
-	assert (fn != NULL);
+	assert (s != NULL);
 
-	return new (config_make (stack_size, flags), fn, data);
+	return s->priority;
 }
 
 void
-strand_free (Strand **sp)
+strand_set_deadline (Strand *s, uint64_t deadline)
 {
-	assert (sp != NULL);
+	assert (s != NULL);
 
-	Strand *s = *sp;
-	if (s == NULL) { return; }
+	s->deadline = deadline;
+}
 
-	ensure (s, s->state != CURRENT, "attempting to free current coroutine");
-	ensure (s, s->state != ACTIVE, "attempting to free an active coroutine");
+uint64_t
+strand_deadline (const Strand *s)
+{
+	assert (s != NULL);
 
-	*sp = NULL;
+	return s->deadline;
+}
 
-	defer_run (&s->defer);
-	free (s->backtrace);
+uint64_t
+strand_clock (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-#if STRAND_VALGRIND
-	VALGRIND_STACK_DEREGISTER (s->stack_id);
+/**
+ * Reads the cheapest available timestamp counter
+ *
+ * @return  timestamp in counter ticks
+ */
+static inline uint64_t
+clock_tsc (void)
+{
+#if STRAND_X86_64 || STRAND_X86_32
+	return __builtin_ia32_rdtsc ();
+#else
+	return strand_clock ();
 #endif
-
-	s->parent = dead;
-	dead = s;
 }
 
-uintptr_t
-strand_yield (uintptr_t val)
+#if STRAND_X86_64 || STRAND_X86_32
+
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+static double clock_per_ns = 0.0;
+
+/**
+ * Measures the timestamp counter rate against the monotonic clock
+ */
+static void
+clock_calibrate (void)
 {
-	Strand *s = current, *p = s->parent;
+	uint64_t ns0 = strand_clock (), tsc0 = clock_tsc (), ns1;
+	while ((ns1 = strand_clock ()) - ns0 < 1000000) {}
+	clock_per_ns = (double)(clock_tsc () - tsc0) / (double)(ns1 - ns0);
+}
 
-	ensure (s, p != NULL, "yield attempted outside of coroutine");
+#endif
+
+/**
+ * Converts nanoseconds to timestamp counter ticks
+ *
+ * The counter rate is measured once by the first thread to need it.
+ *
+ * @param  ns  nanoseconds
+ * @return  number of ticks
+ */
+static uint64_t
+clock_ticks (uint64_t ns)
+{
+#if STRAND_X86_64 || STRAND_X86_32
+	pthread_once (&clock_once, clock_calibrate);
+	uint64_t ticks = (uint64_t)((double)ns * clock_per_ns);
+	return ticks ? ticks : 1;
+#else
+	return ns;
+#endif
+}
 
-	current = p;
+#if STRAND_LINUX
 
-	s->parent = NULL;
-	s->value = val;
-	s->state = SUSPENDED;
-	p->state = CURRENT;
-	strand_ctx_swap (s->ctx, p->ctx);
-	return s->value;
+static void
+on_budget (int sig)
+{
+	(void)sig;
+	budget.expired = 1;
 }
 
-uintptr_t
-strand_resume (Strand *s, uintptr_t val)
+/**
+ * Starts a thread CPU time timer that marks each quantum as expired
+ *
+ * @param  ns  quantum length in nanoseconds
+ * @return  0 on success or `-errno` on error
+ */
+static int
+budget_timer (uint64_t ns)
 {
-	ensure (s, s != NULL, "attempting to resume a null coroutine");
-	ensure (s, s->state != CURRENT, "attempting to resume the current coroutine");
-	ensure (s, s->state != ACTIVE, "attempting to resume an active coroutine");
-	ensure (s, s->state != DEAD, "attempting to resume a dead coroutine");
+	struct sigaction sa;
+	memset (&sa, 0, sizeof sa);
+	sa.sa_handler = on_budget;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset (&sa.sa_mask);
+	if (sigaction (STRAND_BUDGET_SIGNAL, &sa, NULL) < 0) {
+		return -errno;
+	}
 
-	Strand *p = current;
-	if (p == NULL) {
-		p = &top;
+	struct sigevent sev;
+	memset (&sev, 0, sizeof sev);
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = STRAND_BUDGET_SIGNAL;
+	sev._sigev_un._tid = syscall (SYS_gettid);
+	if (timer_create (CLOCK_THREAD_CPUTIME_ID, &sev, &budget.timer) < 0) {
+		return -errno;
+	}
+
+	struct itimerspec its;
+	its.it_interval.tv_sec = ns / 1000000000;
+	its.it_interval.tv_nsec = ns % 1000000000;
+	its.it_value = its.it_interval;
+	if (timer_settime (budget.timer, 0, &its, NULL) < 0) {
+		int err = errno;
+		timer_delete (budget.timer);
+		return -err;
 	}
+	return 0;
+}
 
-	current = s;
+#endif
 
-	s->parent = p;
-	s->value = val;
-	s->state = CURRENT;
-	p->state = ACTIVE;
-	strand_ctx_swap (p->ctx, s->ctx);
+int
+strand_budget (uint64_t ns, uint32_t flags)
+{
+#if STRAND_LINUX
+	if (budget.timed) {
+		timer_delete (budget.timer);
+		budget.timed = false;
+	}
+#endif
 
-	return s->value;
+	budget.ticks = 0;
+	budget.expired = 0;
+	if (ns == 0) {
+		return 0;
+	}
+
+	if (flags & STRAND_BUDGET_FTIMER) {
+#if STRAND_LINUX
+		// the timer is deleted with the thread's caches when it exits
+		thread_own ();
+		int rc = budget_timer (ns);
+		if (rc < 0) {
+			return rc;
+		}
+		budget.timed = true;
+#else
+		return -ENOTSUP;
+#endif
+	}
+
+	budget.ticks = clock_ticks (ns);
+	return 0;
 }
 
-bool
-strand_alive (const Strand *s)
+void
+strand_budget_stats (StrandBudgetStats *stats)
 {
-	assert (s != NULL);
+	assert (stats != NULL);
 
-	return s->state != DEAD;
+	*stats = budget.stats;
 }
 
-size_t
-strand_stack_used (const Strand *s)
+bool
+strand_maybe_yield (void)
 {
-	return strand_ctx_stack_size (s->ctx, MAP_BEGIN (s), STACK_SIZE (s), s == current);
+	if (budget.ticks == 0) {
+		return false;
+	}
+
+	budget.stats.checks++;
+	if (budget.timed ? !budget.expired : clock_tsc () - budget.start < budget.ticks) {
+		return false;
+	}
+
+	// only coroutines resumed by the scheduler can be requeued
+	Strand *s = strand_tls_current;
+	if (s == NULL || s != budget.running) {
+		return false;
+	}
+
+	budget.stats.expired++;
+	strand_sched_yield (0);
+	return true;
 }
 
 int
-strand_defer (void (*fn) (void *), void *data)
+strand_ready (Strand *s, uintptr_t val)
 {
-	assert (fn != NULL);
+	ensure (s, s != NULL, "attempting to ready a null coroutine");
+	ensure (s, s->state != DEAD, "attempting to ready a dead coroutine");
+	ensure (s, !(s->flags & STRAND_FQUEUED), "attempting to ready a queued coroutine");
 
-	StrandDefer *def = pool;
-	if (def != NULL) {
-		pool = def->next;
+	if (ready.mode == STRAND_SCHED_PRIORITY && s->deadline != 0) {
+		int rc = heap_push (s);
+		if (rc < 0) {
+			return rc;
+		}
 	}
 	else {
-		def = malloc (sizeof (*def));
-		if (def == NULL) {
-			return -errno;
+		int p = ready.mode == STRAND_SCHED_PRIORITY ? s->priority : STRAND_PRIORITY_DEFAULT;
+		if (ready.tail[p] == NULL) {
+			ready.head[p] = s;
+			ready.mask |= UINT64_C(1) << p;
+		}
+		else {
+			ready.tail[p]->ready_next = s;
 		}
+		ready.tail[p] = s;
 	}
 
-	def->next = current->defer;
-	def->fn = fn;
-	def->data = data;
-	current->defer = def;
-
+	s->flags |= STRAND_FQUEUED;
+	s->value = val;
 	return 0;
 }
 
-static void *
-defer_free (void *val)
+Strand *
+strand_spawn (uintptr_t (*fn)(void *, uintptr_t), void *data)
 {
-	if (val != NULL && strand_defer (free, val) < 0) {
-		free (val);
-		val = NULL;
+	assert (fn != NULL);
+
+	Strand *s = new (config, fn, data, __builtin_return_address (0));
+	if (s == NULL) {
+		return NULL;
 	}
-	return val;
+
+	s->flags |= STRAND_FSPAWN;
+	int rc = strand_ready (s, 0);
+	if (rc < 0) {
+		strand_free (&s);
+		errno = -rc;
+	}
+	return s;
 }
 
-void *
-strand_malloc (size_t size)
+uintptr_t
+strand_sched_yield (uintptr_t val)
 {
-	return defer_free (malloc (size));
+	Strand *s = strand_tls_current;
+
+	ensure (s, s != NULL && s != &strand_tls_top, "sched yield attempted outside of coroutine");
+
+	// a coroutine that is not queued would never be resumed again
+	int rc = strand_ready (s, val);
+	ensure (s, rc == 0, "failed to requeue coroutine: %s", strerror (-rc));
+	return strand_yield (val);
 }
 
-void *
-strand_calloc (size_t count, size_t size)
+size_t
+strand_sched_run (void)
 {
-	return defer_free (calloc (count, size));
+	size_t n = 0;
+	Strand *s;
+
+	while ((s = ready_pop ()) != NULL) {
+		if (budget.ticks != 0) {
+			budget.running = s;
+			budget.expired = 0;
+			budget.start = budget.timed ? 0 : clock_tsc ();
+			budget.stats.slices++;
+		}
+		strand_resume (s, s->value);
+		budget.running = NULL;
+		if (!strand_alive (s) && (s->flags & STRAND_FSPAWN)) {
+			strand_free (&s);
+		}
+		n++;
+	}
+
+	return n;
 }
 
 void
 strand_print (const Strand *s, FILE *out)
 {
 	if (s == NULL) {
-		s = current;
+		s = strand_tls_current;
 	}
 
 	if (out == NULL) {
@@ -524,11 +2264,9 @@ strand_print (const Strand *s, FILE *out)
 
 	fprintf (out, FMT " {\n", FMTARGS (s));
 	strand_ctx_print (s->ctx, out);
-	if (s->nbacktrace > 0) {
+	if (s->capture != NULL) {
 		fprintf (out, "\tbacktrace:\n");
-		for (int i = 0; i < s->nbacktrace; i++) {
-			fprintf (stderr, "\t\t%s\n", s->backtrace[i]);
-		}
+		capture_print (s->capture, out, "\t\t");
 	}
 	fprintf (out, "}\n");
 }
@@ -558,7 +2296,7 @@ Strand *
 strand_new_b (uintptr_t (^block)(uintptr_t val))
 {
 	uintptr_t (^copy) (uintptr_t) = Block_copy (block);
-	Strand *s = strand_new (block_shim, copy);
+	Strand *s = new (config, block_shim, copy, __builtin_return_address (0));
 
 	if (s == NULL) {
 		Block_release (copy);
@@ -575,7 +2313,8 @@ strand_new_config_b (uint32_t stack_size, uint32_t flags,
 		uintptr_t (^block)(uintptr_t val))
 {
 	uintptr_t (^copy) (uintptr_t) = Block_copy (block);
-	Strand *s = strand_new_config (stack_size, flags, block_shim, copy);
+	Strand *s = new (config_make (stack_size, flags), block_shim, copy,
+			__builtin_return_address (0));
 
 	if (s == NULL) {
 		Block_release (copy);
@@ -6,9 +6,16 @@
 #include <stdbool.h>
 #include <limits.h>
 
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
 #define STRAND_FDEBUG   (UINT32_C(1) << 0) /** enable debug statements */
 #define STRAND_FPROTECT (UINT32_C(1) << 1) /** protect the end of the stack */
 #define STRAND_FCAPTURE (UINT32_C(1) << 2) /** capture stack for new coroutines */
+#define STRAND_FNUMA    (UINT32_C(1) << 3) /** allocate stacks on the local NUMA node */
+#define STRAND_FPREFAULT (UINT32_C(1) << 4) /** fault in the top of the stack at creation */
+#define STRAND_FCOLOR   (UINT32_C(1) << 5) /** vary the cache alignment of new stacks */
 
 /**
  * Minimum allowed stack size
@@ -35,11 +42,38 @@
  */
 #define STRAND_FLAGS_DEBUG (STRAND_FPROTECT | STRAND_FDEBUG | STRAND_FCAPTURE)
 
+/**
+ * Number of mapping size classes reported by `strand_memstats`
+ */
+#define STRAND_MEMSTATS_CLASSES 11
+
 /**
  * Opaque type for coroutine instances
  */
 typedef struct Strand Strand;
 
+/**
+ * Memory usage of coroutine stacks
+ *
+ * Mapping sizes include the stack, the coroutine state and any protected
+ * page. Each size class holds the mappings no larger than its `map_size`
+ * and larger than the previous class, except the last class holds all of
+ * the remaining mappings.
+ */
+typedef struct {
+	size_t mapped;   /** bytes mapped for coroutines in all threads */
+	size_t resident; /** bytes of `mapped` that are resident in memory */
+	size_t cached;   /** bytes of dead mappings cached by the calling thread */
+	size_t shared;   /** bytes of dead mappings in the shared node caches */
+	size_t defer;    /** bytes pooled for deferred calls by the calling thread */
+	struct {
+		size_t map_size; /** largest mapping size in the class */
+		size_t count;    /** number of mappings in the class */
+		size_t mapped;   /** bytes mapped in the class */
+		size_t resident; /** bytes resident in the class */
+	} sizes[STRAND_MEMSTATS_CLASSES];
+} StrandMemStats;
+
 /**
  * Updates the configuration for subsequent coroutines.
  *
@@ -88,12 +122,31 @@ extern Strand *
 strand_new_config (uint32_t stack_size, uint32_t flags,
 		uintptr_t (*fn)(void *, uintptr_t), void *data);
 
+/**
+ * Reinitializes a dead coroutine to run a new function
+ *
+ * The coroutine keeps its stack and configuration, so this is cheaper than
+ * freeing it and creating a new one. Coroutine-local values and deferred
+ * calls have already been released when it died. The result is the same as
+ * a newly created coroutine in a suspended state.
+ *
+ * @param  s     the dead coroutine to reuse
+ * @param  fn    function to invoke with `data`
+ * @param  data  user pointer
+ */
+extern void
+strand_reset (Strand *s, uintptr_t (*fn)(void *, uintptr_t), void *data);
+
 /**
  * Frees an inactive coroutine
  *
  * This returns the memory allocated for the coroutine. This may not actually
  * return the memory to the OS, and the stack may be reused later.
  *
+ * Each thread caches a bounded number of stacks. Beyond that, and when the
+ * thread exits, stacks are moved to a shared cache that other threads
+ * reuse from.
+ *
  * `sp` cannot be `NULL`, but `*sp` may be.
  *
  * @param  sp  reference to the coroutine pointer to free
@@ -127,12 +180,242 @@ strand_yield (uintptr_t val);
  * The returned value is either the value passed into `strand_yield` or the
  * final returned value from the coroutine function.
  *
+ * A suspended coroutine may be resumed from a different thread than the one
+ * that created it or last resumed it.
+ *
  * @param  s    coroutine to activate
  * @param  val  value to pass to the coroutine
  */
 extern uintptr_t
 strand_resume (Strand *s, uintptr_t val);
 
+/**
+ * Number of entries ahead that `strand_resume_batch` prefetches
+ */
+#ifndef STRAND_BATCH_PREFETCH
+# define STRAND_BATCH_PREFETCH 4
+#endif
+
+/**
+ * Resumes each coroutine of a list in turn
+ *
+ * Each coroutine is resumed with 0, as with `strand_resume`. While one
+ * coroutine runs, the state that switching into later entries loads is
+ * prefetched: the coroutine `STRAND_BATCH_PREFETCH * 2` entries ahead and
+ * the saved stack top of the one `STRAND_BATCH_PREFETCH` entries ahead.
+ * This hides the cache misses of driving many coroutines round-robin.
+ *
+ * `NULL` and dead entries are skipped without switching and their results
+ * are left unchanged.
+ *
+ * @param  list     coroutines to resume
+ * @param  n        number of entries
+ * @param  results  value yielded or returned by each entry, or `NULL`
+ * @return  number of coroutines resumed
+ */
+extern size_t
+strand_resume_batch (Strand **list, size_t n, uintptr_t *results);
+
+/**
+ * Prefetches an address and lets another coroutine run
+ *
+ * This hides memory latency by interleaving many lookups, each of which
+ * prefetches the next address it needs and then switches away until the
+ * load has had time to complete.
+ *
+ * Within `strand_group_run`, this switches directly to the next member of
+ * the group without passing through the driver. Otherwise, or while
+ * switches are being traced or counted, this yields 0 to the parent.
+ *
+ * @param  addr  address to prefetch
+ */
+extern void
+strand_prefetch_yield (const void *addr);
+
+/**
+ * Runs a fixed group of coroutines interleaved until all are dead
+ *
+ * Each member is resumed with 0. Members pass control among themselves
+ * round-robin with `strand_prefetch_yield`, and only come back here when
+ * one returns or yields with `strand_yield`, in which case the next member
+ * is resumed.
+ *
+ * The list is reordered as members finish, with the live members kept
+ * at the front. Members that are already dead are moved to the end before
+ * any is resumed. The coroutines are not freed.
+ *
+ * @param  list  coroutines to run
+ * @param  n     number of coroutines
+ */
+extern void
+strand_group_run (Strand **list, size_t n);
+
+/**
+ * Sets how often `STRAND_FCAPTURE` records a creation backtrace
+ *
+ * Only one in every `rate` coroutines created on each thread with the
+ * flag will capture a backtrace. Captures store raw return addresses that
+ * are shared between coroutines created from the same call stack, and
+ * symbols are only resolved when a backtrace is printed.
+ *
+ * @param  rate  sampling rate, where 0 or 1 captures every coroutine
+ */
+extern void
+strand_capture_rate (uint32_t rate);
+
+/**
+ * Gets the NUMA node of the CPU the calling thread is running on
+ *
+ * Coroutines created with `STRAND_FNUMA` prefer memory from this node, and
+ * stacks are cached per node so that they are reused on the same node.
+ *
+ * @return  node index, which is always 0 on single-node systems
+ */
+extern int
+strand_numa_node (void);
+
+/**
+ * Pins the calling thread to a single CPU
+ *
+ * This is useful for threads that run coroutines created with `STRAND_FNUMA`
+ * so that the thread does not migrate away from its stacks.
+ *
+ * @param  cpu  CPU index
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_pin (int cpu);
+
+/**
+ * Collects memory usage for coroutine stacks
+ *
+ * Resident bytes are computed on demand with `mincore` over every mapping,
+ * so the cost is linear in the number of mappings. Mappings cannot be
+ * created or unmapped by other threads while this is running, but stacks
+ * may still be reused.
+ *
+ * @param  st  stats object to fill in
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_memstats (StrandMemStats *st);
+
+/**
+ * Starts or stops recording context switches
+ *
+ * Each thread records resume, yield, dead and free events into its own
+ * fixed-size buffer, overwriting the oldest events once full. The buffer
+ * of an exited thread is kept for dumping until another thread starts
+ * recording and reuses it. Recording is only available when built with
+ * `STRAND_TRACE`, and otherwise this has no effect.
+ *
+ * @param  enable  `true` to record events
+ */
+extern void
+strand_trace_enable (bool enable);
+
+/**
+ * Writes recorded events in the Chrome trace event JSON format
+ *
+ * The output can be loaded into Perfetto or `chrome://tracing`. Each time
+ * a coroutine receives context, a slice is added to the thread's timeline
+ * that lasts until the next context switch on that thread.
+ *
+ * @param  out  `FILE *` handle to write to or `NULL`
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_trace_dump (FILE *out);
+
+/**
+ * Starts sampling the calling thread
+ *
+ * A `SIGPROF` timer is armed against the CPU time of the calling thread.
+ * Each sample records the current coroutine and the frame pointer chain of
+ * its stack, so samples are attributed to the coroutine rather than the
+ * thread. Each thread that should be sampled must call this. The `SIGPROF`
+ * handler is installed on first use.
+ *
+ * Samples recorded by an earlier start on the calling thread are discarded.
+ * When a thread exits, its timer is deleted and its samples are kept for
+ * dumping until another thread starts sampling and reuses the buffer.
+ *
+ * @param  hz  sampling frequency, which must not be 0
+ * @return  0 on success, `-EINVAL` if `hz` is 0, or `-errno` on error
+ */
+extern int
+strand_profile_start (unsigned hz);
+
+/**
+ * Stops sampling the calling thread
+ *
+ * Recorded samples are kept and may still be dumped.
+ */
+extern void
+strand_profile_stop (void);
+
+/**
+ * Writes samples from all threads as folded stacks
+ *
+ * Each line holds the semicolon-separated frames of a unique stack followed
+ * by the number of samples, which can be passed directly to `flamegraph.pl`.
+ * The first frame is `strand@` followed by the function that created the
+ * coroutine, or `main` for samples taken outside of coroutines.
+ *
+ * @param  out  `FILE *` handle to write to or `NULL`
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_profile_dump (FILE *out);
+
+/**
+ * Hardware counts attributed to a coroutine
+ */
+typedef struct {
+	uint64_t instructions; /** retired user-space instructions */
+	uint64_t cycles;       /** user-space CPU cycles */
+	uint64_t cache_misses; /** last level cache misses */
+} StrandPerf;
+
+/**
+ * Starts or stops attributing hardware counters to coroutines
+ *
+ * While enabled, each thread counts instructions, cycles and last level
+ * cache misses, and at every context switch the counts since the previous
+ * switch are added to the coroutine giving up context. Counters are read
+ * with `rdpmc` where the kernel permits it.
+ *
+ * Counts made while disabled are not attributed: after enabling again, the
+ * calling thread counts from this call and other threads from their next
+ * switch.
+ *
+ * Counters are opened on each thread the first time it switches. Where
+ * `perf_event_open` is not permitted or supported, nothing is counted and
+ * all counts stay zero.
+ *
+ * @param  enable  `true` to start or `false` to stop
+ * @return  0 if the calling thread is counting or `-errno` on error
+ */
+extern int
+strand_perf_enable (bool enable);
+
+/**
+ * Gets the hardware counts attributed to a coroutine
+ *
+ * @param  s     the coroutine to access
+ * @param  perf  structure to populate
+ */
+extern void
+strand_perf (const Strand *s, StrandPerf *perf);
+
+/**
+ * Gets the coroutine that currently has context
+ *
+ * @return  current coroutine or `NULL` outside of any coroutine
+ */
+extern Strand *
+strand_current (void);
+
 /**
  * Checks if a coroutine is not dead
  *
@@ -165,12 +448,62 @@ strand_stack_used (const Strand *s);
  * This will be called after the return of the coroutine function but before
  * yielding back to the parent context. Deferred calls occur in LIFO order.
  *
+ * When called from the function of a stackless task, the call is attached
+ * to the task instead, and is invoked when the task finishes.
+ *
  * @param  fn    function to call
  * @param  data  data to pass to `fn`
  */
 extern int
 strand_defer (void (*fn) (void *), void *data);
 
+/**
+ * Maximum number of coroutine-local keys
+ */
+#define STRAND_LOCAL_MAX 64
+
+/**
+ * Identifies a coroutine-local value
+ */
+typedef unsigned StrandLocalKey;
+
+/**
+ * Creates a key for a value stored in each coroutine
+ *
+ * Keys cannot be deleted. When a coroutine terminates or is freed, the
+ * destructor is invoked with each non-NULL value after the deferred calls
+ * have run.
+ *
+ * @param  key   key to initialize
+ * @param  dtor  function to release a value or `NULL`
+ * @return  0 on success or `-EAGAIN` if all keys are used
+ */
+extern int
+strand_local_key_create (StrandLocalKey *key, void (*dtor)(void *));
+
+/**
+ * Gets a value of the current coroutine
+ *
+ * @param  key  key from `strand_local_key_create`
+ * @return  value or `NULL` if unset or outside of a coroutine
+ */
+extern void *
+strand_local_get (StrandLocalKey key);
+
+/**
+ * Sets a value of the current coroutine
+ *
+ * The first few keys are stored within the coroutine. Higher keys use a
+ * table that is allocated the first time one is set.
+ *
+ * @param  key  key from `strand_local_key_create`
+ * @param  val  value to store
+ * @return  0 on success, `-EPERM` outside of a coroutine, `-EINVAL` for an
+ *          invalid key, or `-errno` on error
+ */
+extern int
+strand_local_set (StrandLocalKey key, void *val);
+
 /**
  * Creates an allocation that is freed at termination of the coroutine
  *
@@ -190,6 +523,188 @@ strand_malloc (size_t size);
 extern void *
 strand_calloc (size_t count, size_t size);
 
+/**
+ * Number of priority levels used by the scheduler
+ *
+ * Lower values run first.
+ */
+#define STRAND_PRIORITY_COUNT 64
+#define STRAND_PRIORITY_DEFAULT 32
+
+#define STRAND_SCHED_FIFO     0 /** run ready coroutines in order */
+#define STRAND_SCHED_PRIORITY 1 /** run by deadline and then priority */
+
+/**
+ * Sets the ordering used by the ready queue of the calling thread
+ *
+ * In `STRAND_SCHED_FIFO` mode, ready coroutines run in the order they were
+ * readied. In `STRAND_SCHED_PRIORITY` mode, coroutines with a deadline run
+ * first in earliest-deadline order, followed by the rest in priority order
+ * and FIFO within each priority. The mode should only be changed while the
+ * queue is empty.
+ *
+ * @param  mode  `STRAND_SCHED_FIFO` or `STRAND_SCHED_PRIORITY`
+ */
+extern void
+strand_sched_mode (int mode);
+
+/**
+ * Sets the scheduling priority of a coroutine
+ *
+ * The value is clamped to `[0, STRAND_PRIORITY_COUNT)`. This takes effect
+ * the next time the coroutine is readied.
+ *
+ * @param  s         the coroutine to modify
+ * @param  priority  priority level where lower values run first
+ */
+extern void
+strand_set_priority (Strand *s, int priority);
+
+/**
+ * Gets the scheduling priority of a coroutine
+ *
+ * @param  s  the coroutine to access
+ * @return  priority level
+ */
+extern int
+strand_priority (const Strand *s);
+
+/**
+ * Sets the scheduling deadline of a coroutine
+ *
+ * The deadline is an absolute time from `strand_clock`. This takes effect
+ * the next time the coroutine is readied.
+ *
+ * @param  s         the coroutine to modify
+ * @param  deadline  deadline in nanoseconds or 0 for none
+ */
+extern void
+strand_set_deadline (Strand *s, uint64_t deadline);
+
+/**
+ * Gets the scheduling deadline of a coroutine
+ *
+ * @param  s  the coroutine to access
+ * @return  deadline in nanoseconds or 0 for none
+ */
+extern uint64_t
+strand_deadline (const Strand *s);
+
+/**
+ * Gets the current time of the clock used for deadlines
+ *
+ * @return  monotonic time in nanoseconds
+ */
+extern uint64_t
+strand_clock (void);
+
+/**
+ * Adds a coroutine to the ready queue of the calling thread
+ *
+ * The coroutine will be resumed with `val` by `strand_sched_run`. It may
+ * not be freed while it is queued.
+ *
+ * @param  s    the coroutine to schedule
+ * @param  val  value to resume with
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_ready (Strand *s, uintptr_t val);
+
+/**
+ * Creates a new coroutine and adds it to the ready queue
+ *
+ * The coroutine is owned by the scheduler and is freed by `strand_sched_run`
+ * once it is dead.
+ *
+ * @param  fn    function to invoke with `data`
+ * @param  data  user pointer
+ * @return  new coroutine or `NULL` on error
+ */
+extern Strand *
+strand_spawn (uintptr_t (*fn)(void *, uintptr_t), void *data);
+
+/**
+ * Requeues the current coroutine and yields
+ *
+ * Aborts if the coroutine cannot be queued, as it would otherwise never be
+ * resumed.
+ *
+ * @param  val  value to yield and later resume with
+ * @return  value passed when resumed
+ */
+extern uintptr_t
+strand_sched_yield (uintptr_t val);
+
+/**
+ * Runs ready coroutines until the queue is empty
+ *
+ * @return  number of coroutines resumed
+ */
+extern size_t
+strand_sched_run (void);
+
+/**
+ * Use a timer signal rather than timestamps to expire the time slice
+ */
+#define STRAND_BUDGET_FTIMER (UINT32_C(1) << 0)
+
+/**
+ * Signal used for `STRAND_BUDGET_FTIMER`
+ */
+#ifndef STRAND_BUDGET_SIGNAL
+# define STRAND_BUDGET_SIGNAL (SIGRTMIN + 1)
+#endif
+
+/**
+ * Time slice statistics of a thread
+ */
+typedef struct {
+	uint64_t slices;  /** coroutines resumed by the scheduler with a budget */
+	uint64_t checks;  /** calls to `strand_maybe_yield` */
+	uint64_t expired; /** checks that found the budget exceeded and yielded */
+} StrandBudgetStats;
+
+/**
+ * Sets the time slice budget of coroutines run by the calling thread
+ *
+ * Each time `strand_sched_run` resumes a coroutine, a new slice starts. A
+ * long-running coroutine should call `strand_maybe_yield` periodically,
+ * which requeues it once the slice has been used.
+ *
+ * By default, the check reads the timestamp counter. With
+ * `STRAND_BUDGET_FTIMER`, a thread CPU time timer instead delivers
+ * `STRAND_BUDGET_SIGNAL` every `ns`, and the check only tests a flag set
+ * by the handler. The timer is not aligned with slice starts, and its
+ * resolution is limited by the kernel's CPU time accounting, so slices may
+ * be shorter or much longer than a small `ns`.
+ *
+ * @param  ns     slice length in nanoseconds or 0 to disable
+ * @param  flags  budget flags
+ * @return  0 on success or `-errno` on error
+ */
+extern int
+strand_budget (uint64_t ns, uint32_t flags);
+
+/**
+ * Gets the time slice statistics of the calling thread
+ *
+ * @param  stats  structure to populate
+ */
+extern void
+strand_budget_stats (StrandBudgetStats *stats);
+
+/**
+ * Yields to the scheduler if the time slice of the current coroutine is used
+ *
+ * This does nothing when no budget is set, or when the current coroutine
+ * was not resumed by `strand_sched_run`.
+ *
+ * @return  `true` if the coroutine yielded
+ */
+extern bool
+strand_maybe_yield (void);
+
 /**
  * Prints a representation of the coroutine
  *
@@ -253,5 +768,9 @@ strand_defer_b (void (^block)(void));
 
 #endif
 
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
 #endif
 
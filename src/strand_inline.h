@@ -0,0 +1,180 @@
+#ifndef STRAND_INLINE_H
+#define STRAND_INLINE_H
+
+/**
+ * Inlinable context switch fast paths
+ *
+ * The functions in this header perform a plain resume or yield without a
+ * call into the library. Anything other than a plain switch, such as an
+ * invalid state, an enabled trace, or counter attribution, falls back to
+ * the regular function, so behavior is the same as `strand_resume` and
+ * `strand_yield`.
+ *
+ * The thread-local state is accessed using the initial-exec model. When
+ * linking against the shared library, it must be loaded at startup rather
+ * than with `dlopen`.
+ */
+
+#include "strand.h"
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+#if defined (__x86_64__) || defined (__i386__)
+# define STRAND_HEAD_REGS 1
+#endif
+
+#define STRAND_HEAD_SUSPENDED 0 /** new created or yielded */
+#define STRAND_HEAD_CURRENT   1 /** currently has context */
+#define STRAND_HEAD_ACTIVE    2 /** is in the parent list of the current */
+#define STRAND_HEAD_DEAD      3 /** function has returned */
+
+#if defined (STRAND_HEAD_REGS)
+
+/**
+ * Leading fields of a coroutine used by context switches
+ *
+ * This matches the start of the private coroutine structure.
+ */
+typedef struct {
+	uintptr_t ctx[STRAND_HEAD_REGS];
+	Strand *parent;
+	uintptr_t value;
+	int state;
+} StrandHead;
+
+/**
+ * Coroutine that currently has context or `NULL` before the first switch
+ */
+extern __thread Strand *strand_tls_current
+	__attribute__ ((tls_model ("initial-exec")));
+
+/**
+ * Placeholder coroutine for the thread's main context
+ */
+extern __thread Strand strand_tls_top
+	__attribute__ ((tls_model ("initial-exec")));
+
+/**
+ * Set while context switches are being recorded
+ */
+extern bool strand_trace_active;
+
+/**
+ * Set while hardware counters are being attributed to coroutines
+ */
+extern bool strand_perf_active;
+
+/**
+ * Swaps execution contexts
+ *
+ * @param  save  destination to save current context
+ * @param  load  context to activate
+ */
+extern void
+strand_ctx_switch (uintptr_t *save, const uintptr_t *load);
+
+/**
+ * Inlinable version of `strand_resume`
+ *
+ * @param  s    the coroutine to resume
+ * @param  val  value to send to the coroutine
+ * @return  value yielded or returned from the coroutine
+ */
+static inline uintptr_t
+strand_resume_inline (Strand *s, uintptr_t val)
+{
+	StrandHead *sh = (StrandHead *)s;
+	if (__builtin_expect (s == NULL || sh->state != STRAND_HEAD_SUSPENDED ||
+				strand_trace_active || strand_perf_active, 0)) {
+		return strand_resume (s, val);
+	}
+
+	Strand *p = strand_tls_current;
+	if (p == NULL) {
+		p = &strand_tls_top;
+	}
+	StrandHead *ph = (StrandHead *)p;
+
+	strand_tls_current = s;
+
+	sh->parent = p;
+	sh->value = val;
+	sh->state = STRAND_HEAD_CURRENT;
+	ph->state = STRAND_HEAD_ACTIVE;
+	strand_ctx_switch (ph->ctx, sh->ctx);
+
+	return sh->value;
+}
+
+/**
+ * Inlinable version of `strand_yield`
+ *
+ * @param  val  value to send to the parent
+ * @return  value passed when resumed
+ */
+static inline uintptr_t
+strand_yield_inline (uintptr_t val)
+{
+	Strand *s = strand_tls_current;
+	if (__builtin_expect (s == NULL || s == &strand_tls_top ||
+				strand_trace_active || strand_perf_active, 0)) {
+		return strand_yield (val);
+	}
+
+	StrandHead *sh = (StrandHead *)s;
+	Strand *p = sh->parent;
+	StrandHead *ph = (StrandHead *)p;
+
+	strand_tls_current = p;
+
+	sh->parent = NULL;
+	sh->value = val;
+	sh->state = STRAND_HEAD_SUSPENDED;
+	ph->state = STRAND_HEAD_CURRENT;
+	strand_ctx_switch (sh->ctx, ph->ctx);
+
+	return sh->value;
+}
+
+/**
+ * Inlinable version of `strand_alive`
+ *
+ * @param  s  the coroutine to test or `NULL`
+ * @return  `true` if alive, `false` if dead
+ */
+static inline bool
+strand_alive_inline (const Strand *s)
+{
+	return s != NULL && ((const StrandHead *)s)->state != STRAND_HEAD_DEAD;
+}
+
+#else
+
+static inline uintptr_t
+strand_resume_inline (Strand *s, uintptr_t val)
+{
+	return strand_resume (s, val);
+}
+
+static inline uintptr_t
+strand_yield_inline (uintptr_t val)
+{
+	return strand_yield (val);
+}
+
+static inline bool
+strand_alive_inline (const Strand *s)
+{
+	return strand_alive (s);
+}
+
+#endif
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
@@ -0,0 +1,146 @@
+#ifndef STRAND_TASK_H
+#define STRAND_TASK_H
+
+#include "strand.h"
+
+#if defined (__GNUC__)
+# pragma GCC visibility push(default)
+#endif
+
+/**
+ * Resume point of a task that has returned
+ */
+#define STRAND_TASK_DONE UINT32_MAX
+
+typedef struct StrandTask StrandTask;
+
+/**
+ * A stackless coroutine
+ *
+ * A task function is written with the `STRAND_TASK_*` macros. It returns to
+ * the caller of `strand_task_resume` at each yield, and continues from the
+ * same point when resumed. Local variables do not survive a yield, so state
+ * that does must be kept in a structure that embeds the task, and the task
+ * function may only yield from its own body, not from functions it calls.
+ * Only one yield may appear on each source line.
+ *
+ *     typedef struct {
+ *         StrandTask task;
+ *         unsigned beats;
+ *     } Heartbeat;
+ *
+ *     static uintptr_t
+ *     heartbeat (StrandTask *t, uintptr_t val)
+ *     {
+ *         Heartbeat *h = (Heartbeat *)t;
+ *         STRAND_TASK_BEGIN (t);
+ *         while (val != 0) {
+ *             h->beats++;
+ *             STRAND_TASK_YIELD (t, h->beats);
+ *         }
+ *         STRAND_TASK_END (t);
+ *     }
+ *
+ * After a yield, the value passed to `strand_task_resume` is in `val`.
+ *
+ * Calls to `strand_defer` made from the task function are attached to the
+ * task, and are invoked in LIFO order when it returns or is cancelled. The
+ * library does not allocate tasks.
+ */
+struct StrandTask {
+	uintptr_t (*fn) (StrandTask *, uintptr_t);
+	struct StrandDefer *defer;
+	uint32_t line;
+	int state;
+};
+
+/**
+ * Static initializer for a suspended task
+ */
+#define STRAND_TASK_INIT(fn) { (fn), NULL, 0, 0 }
+
+/**
+ * Starts the body of a task function
+ *
+ * @param  t  task pointer
+ */
+#define STRAND_TASK_BEGIN(t) switch ((t)->line) { case 0:
+
+/**
+ * Suspends a task and returns a value to the caller of `strand_task_resume`
+ *
+ * @param  t    task pointer
+ * @param  val  value to yield
+ */
+#define STRAND_TASK_YIELD(t, val) do { \
+	(t)->line = __LINE__;              \
+	return (val);                      \
+	case __LINE__:;                    \
+} while (0)
+
+/**
+ * Finishes a task with a value
+ *
+ * @param  t    task pointer
+ * @param  val  value to return
+ */
+#define STRAND_TASK_RETURN(t, val) do { \
+	(t)->line = STRAND_TASK_DONE;       \
+	return (val);                       \
+} while (0)
+
+/**
+ * Ends the body of a task function, finishing the task with 0
+ *
+ * @param  t  task pointer
+ */
+#define STRAND_TASK_END(t) } (t)->line = STRAND_TASK_DONE; return 0
+
+/**
+ * Initializes a task in a suspended state
+ *
+ * @param  t   task to initialize
+ * @param  fn  task function
+ */
+extern void
+strand_task_init (StrandTask *t, uintptr_t (*fn)(StrandTask *, uintptr_t));
+
+/**
+ * Runs a task until it yields or returns
+ *
+ * On the first activation, `val` is the input parameter to the function.
+ * Once the task returns, its deferred calls are invoked before this
+ * returns.
+ *
+ * @param  t    suspended task
+ * @param  val  value to pass to the task
+ * @return  value yielded or returned from the task
+ */
+extern uintptr_t
+strand_task_resume (StrandTask *t, uintptr_t val);
+
+/**
+ * Checks if a task has not returned
+ *
+ * @param  t  task
+ * @return  `true` if alive, `false` if dead
+ */
+extern bool
+strand_task_alive (const StrandTask *t);
+
+/**
+ * Finishes a suspended task without resuming it
+ *
+ * The deferred calls of the task are invoked, and it becomes dead.
+ *
+ * @param  t  task
+ */
+extern void
+strand_task_cancel (StrandTask *t);
+
+#if defined (__GNUC__)
+# pragma GCC visibility pop
+#endif
+
+#endif
+
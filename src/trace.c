@@ -0,0 +1,304 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+
+/**
+ * Number of events held by each thread's buffer
+ *
+ * This must be a power of 2. Older events are overwritten once full.
+ */
+#ifndef STRAND_TRACE_SIZE
+# define STRAND_TRACE_SIZE 16384
+#endif
+
+bool strand_trace_active = false;
+
+#if STRAND_TRACE
+
+typedef struct TraceEvent TraceEvent;
+typedef struct TraceRing TraceRing;
+
+struct TraceEvent {
+	uint64_t tsc;
+	const Strand *from, *to;
+	int type;
+};
+
+/**
+ * Single-producer event buffer for a thread
+ *
+ * Only the owning thread writes events. `head` counts every event ever
+ * written, and it is published after the event so a reader can detect
+ * events that were overwritten while being read. Once the owning thread
+ * exits, the buffer is `retired`: its events can still be dumped, but the
+ * next thread to record an event takes it over.
+ */
+struct TraceRing {
+	TraceRing *next;
+	uint64_t head;
+	unsigned id;
+	bool retired;
+	TraceEvent events[STRAND_TRACE_SIZE];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing *rings = NULL;
+static unsigned nrings = 0;
+static uint64_t base_tsc = 0, base_ns = 0;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static __thread TraceRing *ring = NULL;
+
+static const char *type_names[] = {
+	[TRACE_RESUME] = "resume",
+	[TRACE_YIELD]  = "yield",
+	[TRACE_DEAD]   = "dead",
+	[TRACE_FREE]   = "free",
+};
+
+static uint64_t
+clock_ns (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Reads the cheapest available timestamp counter
+ *
+ * @return  timestamp in counter ticks
+ */
+static inline uint64_t
+clock_tsc (void)
+{
+#if STRAND_X86_64 || STRAND_X86_32
+	return __builtin_ia32_rdtsc ();
+#else
+	return clock_ns ();
+#endif
+}
+
+/**
+ * Retires the buffer of an exiting thread
+ *
+ * @param  data  ring pointer
+ */
+static void
+ring_release (void *data)
+{
+	TraceRing *r = data;
+	ring = NULL;
+	pthread_mutex_lock (&lock);
+	r->retired = true;
+	pthread_mutex_unlock (&lock);
+}
+
+static void
+key_create (void)
+{
+	pthread_key_create (&key, ring_release);
+}
+
+/**
+ * Takes a retired buffer or allocates and registers a new one for the
+ * calling thread
+ *
+ * The events of a reused buffer are discarded, so there are never more
+ * buffers than threads that have recorded events at the same time.
+ *
+ * @return  buffer or `NULL` on error
+ */
+static TraceRing *
+ring_new (void)
+{
+	TraceRing *r = NULL;
+
+	pthread_mutex_lock (&lock);
+	for (TraceRing *it = rings; it != NULL; it = it->next) {
+		if (it->retired) {
+			r = it;
+			break;
+		}
+	}
+	if (r != NULL) {
+		r->retired = false;
+		r->head = 0;
+		r->id = ++nrings;
+	}
+	else if ((r = calloc (1, sizeof (*r))) != NULL) {
+		r->id = ++nrings;
+		r->next = rings;
+		rings = r;
+	}
+	pthread_mutex_unlock (&lock);
+
+	if (r != NULL) {
+		pthread_once (&once, key_create);
+		pthread_setspecific (key, r);
+	}
+	return r;
+}
+
+void
+strand_trace_record (int type, const Strand *from, const Strand *to)
+{
+	TraceRing *r = ring;
+	if (r == NULL && (r = ring = ring_new ()) == NULL) {
+		return;
+	}
+
+	TraceEvent *ev = &r->events[r->head & (STRAND_TRACE_SIZE - 1)];
+	ev->tsc = clock_tsc ();
+	ev->from = from;
+	ev->to = to;
+	ev->type = type;
+	__atomic_store_n (&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Prints the name of a coroutine as a JSON string
+ *
+ * @param  s    coroutine or `NULL` for the thread's main context
+ * @param  out  output `FILE *` object
+ */
+static void
+print_name (const Strand *s, FILE *out)
+{
+	if (s == NULL) {
+		fprintf (out, "\"main\"");
+	}
+	else {
+		fprintf (out, "\"#<Strand:%012" PRIxPTR ">\"", (uintptr_t)s);
+	}
+}
+
+/**
+ * Prints a slice for the coroutine that received context in an event
+ *
+ * @param  r      thread buffer
+ * @param  ev     switch event starting the slice
+ * @param  start  start time in microseconds
+ * @param  end    end time in microseconds
+ * @param  out    output `FILE *` object
+ */
+static void
+slice_dump (TraceRing *r, const TraceEvent *ev, double start, double end, FILE *out)
+{
+	fprintf (out, ",\n{\"name\":");
+	print_name (ev->to, out);
+	fprintf (out, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+			"\"pid\":1,\"tid\":%u,\"args\":{\"from\":",
+			type_names[ev->type], start, end - start, r->id);
+	print_name (ev->from, out);
+	fprintf (out, "}}");
+}
+
+/**
+ * Prints the events of a single thread
+ *
+ * Each switch event starts a slice for the coroutine receiving context that
+ * lasts until the next switch on the same thread. The final slice ends at
+ * the last recorded event. Free events are printed as instant events.
+ *
+ * @param  r       thread buffer
+ * @param  out     output `FILE *` object
+ * @param  per_us  timestamp ticks per microsecond
+ * @param  comma   if a separator is needed before the first event
+ */
+static void
+ring_dump (TraceRing *r, FILE *out, double per_us, bool comma)
+{
+	uint64_t head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = head > STRAND_TRACE_SIZE ? head - STRAND_TRACE_SIZE : 0;
+
+	fprintf (out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+			"\"args\":{\"name\":\"thread %u\"}}", comma ? "," : "", r->id, r->id);
+
+	TraceEvent last = { .type = -1 };
+	double start = 0.0, ts = 0.0;
+	for (uint64_t i = tail; i < head; i++) {
+		TraceEvent ev = r->events[i & (STRAND_TRACE_SIZE - 1)];
+
+		// the slot is rewritten once `head` reaches the event a lap later, so
+		// the copy is only kept if that had not happened by the time it ended
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (__atomic_load_n (&r->head, __ATOMIC_RELAXED) - i >= STRAND_TRACE_SIZE) {
+			last.type = -1;
+			continue;
+		}
+
+		ts = (double)(int64_t)(ev.tsc - base_tsc) / per_us;
+		if (ev.type == TRACE_FREE) {
+			fprintf (out, ",\n{\"name\":");
+			print_name (ev.from, out);
+			fprintf (out, ",\"cat\":\"free\",\"ph\":\"i\",\"s\":\"t\","
+					"\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts, r->id);
+			continue;
+		}
+
+		if (last.type >= 0) {
+			slice_dump (r, &last, start, ts, out);
+		}
+		last = ev;
+		start = ts;
+	}
+
+	if (last.type >= 0) {
+		slice_dump (r, &last, start, ts, out);
+	}
+}
+
+#endif
+
+void
+strand_trace_enable (bool enable)
+{
+#if STRAND_TRACE
+	if (enable && base_tsc == 0) {
+		base_ns = clock_ns ();
+		base_tsc = clock_tsc ();
+	}
+	__atomic_store_n (&strand_trace_active, enable, __ATOMIC_RELEASE);
+#else
+	(void)enable;
+#endif
+}
+
+int
+strand_trace_dump (FILE *out)
+{
+	if (out == NULL) {
+		out = stdout;
+	}
+
+	fprintf (out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+#if STRAND_TRACE
+	double per_us = 1.0;
+	if (base_tsc != 0) {
+		uint64_t ns = clock_ns () - base_ns;
+		uint64_t tsc = clock_tsc () - base_tsc;
+		if (ns > 0 && tsc > 0) {
+			per_us = (double)tsc * 1000.0 / (double)ns;
+		}
+	}
+
+	pthread_mutex_lock (&lock);
+	for (TraceRing *r = rings; r != NULL; r = r->next) {
+		ring_dump (r, out, per_us, r != rings);
+	}
+	pthread_mutex_unlock (&lock);
+#endif
+
+	fprintf (out, "\n]}\n");
+	fflush (out);
+	return ferror (out) ? -EIO : 0;
+}
+
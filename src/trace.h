@@ -0,0 +1,61 @@
+#ifndef STRAND_TRACE_H
+#define STRAND_TRACE_H
+
+#include "strand.h"
+#include "config.h"
+
+#define TRACE_RESUME 0 /** a coroutine was given context */
+#define TRACE_YIELD  1 /** a coroutine gave context back to its parent */
+#define TRACE_DEAD   2 /** a coroutine returned from its function */
+#define TRACE_FREE   3 /** a coroutine was freed */
+
+/**
+ * Set while context switches are being recorded
+ *
+ * This is exported for the fast paths in "strand_inline.h", and it is
+ * always `false` when tracing is compiled out.
+ */
+extern bool strand_trace_active
+	__attribute__ ((visibility ("default")));
+
+#if STRAND_TRACE
+
+/**
+ * Records an event into the calling thread's trace buffer
+ *
+ * A buffer of `STRAND_TRACE_SIZE` events is allocated the first time a
+ * thread records an event. When the thread exits, its buffer is kept for
+ * dumping until another thread records an event and reuses it, so memory
+ * is bounded by the largest number of threads recording at once.
+ *
+ * @param  type  event type
+ * @param  from  coroutine giving up context
+ * @param  to    coroutine receiving context
+ */
+extern void
+strand_trace_record (int type, const Strand *from, const Strand *to)
+	__attribute__ ((cold, noinline));
+
+/**
+ * Records an event if tracing is enabled
+ *
+ * When tracing is disabled this costs a single, well-predicted branch.
+ *
+ * @param  type  event type
+ * @param  from  coroutine giving up context
+ * @param  to    coroutine receiving context
+ */
+# define trace(type, from, to) do {                    \
+	if (__builtin_expect (strand_trace_active, 0)) {   \
+		strand_trace_record ((type), (from), (to));    \
+	}                                                  \
+} while (0)
+
+#else
+
+# define trace(type, from, to) ((void)0)
+
+#endif
+
+#endif
+
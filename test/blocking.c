@@ -0,0 +1,110 @@
+#include "mu.h"
+
+#include "../src/blocking.h"
+
+#include <poll.h>
+
+static uintptr_t
+slow (void *arg)
+{
+	usleep (50000);
+	return (uintptr_t)arg * 2;
+}
+
+static uintptr_t
+blocker (void *data, uintptr_t val)
+{
+	(void)val;
+	return strand_blocking (slow, data);
+}
+
+static uintptr_t
+ticker (void *data, uintptr_t val)
+{
+	while (true) {
+		(*(int *)data)++;
+		val = strand_yield (val);
+	}
+	return 0;
+}
+
+static void
+test_blocking (void)
+{
+	int ticks = 0;
+	Strand *b = strand_new (blocker, (void *)21);
+	Strand *t = strand_new (ticker, &ticks);
+
+	mu_assert_uint_eq (strand_resume (b, 0), STRAND_BLOCKED);
+	mu_assert (strand_alive (b));
+
+	// resuming before the call completes suspends again
+	mu_assert_uint_eq (strand_resume (b, 0), STRAND_BLOCKED);
+	mu_assert (strand_alive (b));
+
+	int fd = strand_blocking_fd ();
+	mu_fassert_int_ge (fd, 0);
+
+	while (strand_alive (b)) {
+		strand_resume (t, 0);
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		if (poll (&pfd, 1, 1) > 0) {
+			strand_blocking_poll ();
+		}
+	}
+
+	// the ticker kept running while the blocking call was in progress
+	mu_assert_int_gt (ticks, 10);
+	mu_assert_int_eq (strand_blocking_poll (), 0);
+
+	strand_free (&b);
+	strand_free (&t);
+}
+
+static uintptr_t
+many (void *data, uintptr_t val)
+{
+	(void)data;
+	return strand_blocking (slow, (void *)val);
+}
+
+static void
+test_batch (void)
+{
+	Strand *list[8];
+	for (uintptr_t i = 0; i < 8; i++) {
+		list[i] = strand_new (many, NULL);
+		strand_resume (list[i], i);
+	}
+
+	int done = 0;
+	while (done < 8) {
+		struct pollfd pfd = { .fd = strand_blocking_fd (), .events = POLLIN };
+		poll (&pfd, 1, 1000);
+		done += strand_blocking_poll ();
+	}
+
+	for (uintptr_t i = 0; i < 8; i++) {
+		mu_assert (!strand_alive (list[i]));
+		strand_free (&list[i]);
+	}
+}
+
+static void
+test_outside (void)
+{
+	mu_assert_uint_eq (strand_blocking (slow, (void *)5), 10);
+}
+
+int
+main (void)
+{
+	mu_init ("blocking");
+
+	test_blocking ();
+	test_batch ();
+	test_outside ();
+
+	mu_exit ();
+}
+
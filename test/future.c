@@ -0,0 +1,188 @@
+#include "mu.h"
+
+#include "../src/future.h"
+
+static StrandFuture *futures[3];
+static char order[16];
+static int norder = 0;
+
+static uintptr_t
+await_one (void *data, uintptr_t val)
+{
+	(void)val;
+	uintptr_t v = strand_future_await (futures[0]);
+	order[norder++] = *(char *)data;
+	return v;
+}
+
+static void
+test_await (void)
+{
+	futures[0] = strand_future_new ();
+	mu_fassert (futures[0] != NULL);
+	norder = 0;
+
+	Strand *a = strand_new (await_one, "a");
+	Strand *b = strand_new (await_one, "b");
+	mu_assert_uint_eq (strand_resume (a, 0), STRAND_AWAITING);
+	mu_assert_uint_eq (strand_resume (b, 0), STRAND_AWAITING);
+	mu_assert (!strand_future_done (futures[0]));
+
+	// completion resumes both waiters before returning
+	mu_assert_int_eq (strand_future_complete (futures[0], 42), 0);
+	mu_assert (!strand_alive (a));
+	mu_assert (!strand_alive (b));
+	mu_assert_int_eq (norder, 2);
+	mu_assert_int_eq (order[0], 'a');
+	mu_assert_int_eq (order[1], 'b');
+	mu_assert_int_eq (strand_future_complete (futures[0], 1), -EALREADY);
+
+	// a complete future does not suspend
+	strand_free (&a);
+	a = strand_new (await_one, "c");
+	mu_assert_uint_eq (strand_resume (a, 0), 42);
+
+	strand_free (&a);
+	strand_free (&b);
+	strand_future_free (&futures[0]);
+	mu_assert_ptr_eq (futures[0], NULL);
+}
+
+static uintptr_t
+await_all (void *data, uintptr_t val)
+{
+	(void)val;
+	strand_future_await_all (futures, 3);
+	*(uintptr_t *)data = strand_future_await (futures[0]) +
+		strand_future_await (futures[1]) +
+		strand_future_await (futures[2]);
+	return 0;
+}
+
+static uintptr_t
+complete (void *data, uintptr_t val)
+{
+	strand_future_complete (data, val);
+	return 0;
+}
+
+static void
+test_await_all (void)
+{
+	for (int i = 0; i < 3; i++) {
+		futures[i] = strand_future_new ();
+	}
+
+	uintptr_t sum = 0;
+	Strand *w = strand_new (await_all, &sum);
+	mu_assert_uint_eq (strand_resume (w, 0), STRAND_AWAITING);
+
+	// completions from other coroutines, out of order
+	int seq[3] = { 2, 0, 1 };
+	for (int i = 0; i < 3; i++) {
+		Strand *c = strand_new (complete, futures[seq[i]]);
+		strand_resume (c, 10 * (seq[i] + 1));
+		strand_free (&c);
+		mu_assert (strand_alive (w) == (i < 2));
+	}
+
+	mu_assert_uint_eq (sum, 60);
+	strand_free (&w);
+	for (int i = 0; i < 3; i++) {
+		strand_future_free (&futures[i]);
+	}
+}
+
+static uintptr_t resumes = 0;
+
+static uintptr_t
+await_any (void *data, uintptr_t val)
+{
+	(void)data;
+	(void)val;
+	size_t i = strand_future_await_any (futures, 3);
+	resumes++;
+	strand_yield (i);
+	return 0;
+}
+
+static void
+test_await_any (void)
+{
+	for (int i = 0; i < 3; i++) {
+		futures[i] = strand_future_new ();
+	}
+	resumes = 0;
+
+	Strand *w = strand_new (await_any, NULL);
+	mu_assert_uint_eq (strand_resume (w, 0), STRAND_AWAITING);
+
+	strand_future_complete (futures[1], 7);
+	mu_assert_uint_eq (resumes, 1);
+
+	// the waiter is no longer linked to the others
+	strand_future_complete (futures[2], 8);
+	strand_future_complete (futures[0], 9);
+	mu_assert_uint_eq (resumes, 1);
+
+	strand_free (&w);
+
+	// with a future already complete, the first complete index is returned
+	w = strand_new (await_any, NULL);
+	mu_assert_uint_eq (strand_resume (w, 0), 0);
+	strand_free (&w);
+
+	for (int i = 0; i < 3; i++) {
+		strand_future_free (&futures[i]);
+	}
+
+	// too many futures to wait on are only checked for a complete one
+	StrandFuture *many[STRAND_FUTURE_ANY_MAX + 1];
+	for (int i = 0; i <= STRAND_FUTURE_ANY_MAX; i++) {
+		many[i] = strand_future_new ();
+	}
+	mu_assert_uint_eq (strand_future_await_any (many, STRAND_FUTURE_ANY_MAX + 1),
+			STRAND_FUTURE_ANY_MAX + 1);
+	strand_future_complete (many[STRAND_FUTURE_ANY_MAX], 1);
+	mu_assert_uint_eq (strand_future_await_any (many, STRAND_FUTURE_ANY_MAX + 1),
+			STRAND_FUTURE_ANY_MAX);
+	for (int i = 0; i <= STRAND_FUTURE_ANY_MAX; i++) {
+		strand_future_free (&many[i]);
+	}
+}
+
+static void
+test_slab (void)
+{
+	StrandFuture *a = strand_future_new ();
+	StrandFuture *saved = a;
+	strand_future_free (&a);
+
+	// the most recently freed future is reused first
+	a = strand_future_new ();
+	mu_assert_ptr_eq (a, saved);
+	mu_assert (!strand_future_done (a));
+
+	StrandFuture *many[200];
+	for (int i = 0; i < 200; i++) {
+		many[i] = strand_future_new ();
+		mu_fassert (many[i] != NULL);
+	}
+	for (int i = 0; i < 200; i++) {
+		strand_future_free (&many[i]);
+	}
+	strand_future_free (&a);
+}
+
+int
+main (void)
+{
+	mu_init ("future");
+
+	test_await ();
+	test_await_all ();
+	test_await_any ();
+	test_slab ();
+
+	mu_exit ();
+}
@@ -0,0 +1,88 @@
+#include "mu.h"
+
+#include "../src/parallel.h"
+
+#define COUNT 100000
+
+static void
+sum_range (void *data, size_t begin, size_t end)
+{
+	uint64_t sum = 0;
+	for (size_t i = begin; i < end; i++) {
+		sum += i;
+	}
+	__sync_fetch_and_add ((uint64_t *)data, sum);
+}
+
+static void
+test_sum (void)
+{
+	uint64_t sum = 0;
+	mu_assert_int_eq (strand_parallel_for (0, COUNT, 1000, sum_range, &sum), 0);
+	mu_assert_uint_eq (sum, (uint64_t)COUNT * (COUNT - 1) / 2);
+}
+
+static void
+test_empty (void)
+{
+	uint64_t sum = 0;
+	mu_assert_int_eq (strand_parallel_for (10, 10, 1, sum_range, &sum), 0);
+	mu_assert_uint_eq (sum, 0);
+}
+
+static uint8_t visits[100][100];
+
+static void
+visit_col (void *data, size_t begin, size_t end)
+{
+	size_t row = (uintptr_t)data;
+	for (size_t i = begin; i < end; i++) {
+		__sync_fetch_and_add (&visits[row][i], 1);
+	}
+}
+
+static void
+visit_row (void *data, size_t begin, size_t end)
+{
+	(void)data;
+	for (size_t i = begin; i < end; i++) {
+		strand_parallel_for (0, 100, 7, visit_col, (void *)(uintptr_t)i);
+	}
+}
+
+static void
+test_nested (void)
+{
+	memset (visits, 0, sizeof visits);
+	mu_assert_int_eq (strand_parallel_for (0, 100, 3, visit_row, NULL), 0);
+
+	int bad = 0;
+	for (size_t r = 0; r < 100; r++) {
+		for (size_t c = 0; c < 100; c++) {
+			bad += visits[r][c] != 1;
+		}
+	}
+	mu_assert_int_eq (bad, 0);
+}
+
+int
+main (void)
+{
+	mu_init ("parallel");
+
+	mu_assert_int_eq (strand_parallel_start (4), 0);
+	mu_assert_int_eq (strand_parallel_start (4), -EALREADY);
+
+	test_sum ();
+	test_empty ();
+	test_nested ();
+
+	strand_parallel_stop ();
+
+	// the pool is started on demand after being stopped
+	test_sum ();
+	strand_parallel_stop ();
+
+	mu_exit ();
+}
+
@@ -0,0 +1,126 @@
+#include "mu.h"
+
+#include "../src/park.h"
+
+#include <pthread.h>
+
+static StrandPark park = STRAND_PARK_INIT;
+static int flag = 0;
+
+static bool
+flag_set (void *data)
+{
+	(void)data;
+	return __atomic_load_n (&flag, __ATOMIC_SEQ_CST) != 0;
+}
+
+static void *
+waiter (void *data)
+{
+	(void)data;
+	strand_park_wait (&park, flag_set, NULL);
+	return NULL;
+}
+
+static void
+test_ready (void)
+{
+	StrandParkStats st;
+	__atomic_store_n (&flag, 1, __ATOMIC_SEQ_CST);
+	strand_park_wait (&park, flag_set, NULL);
+	strand_park_stats (&park, &st);
+	mu_assert_uint_eq (st.parks, 0);
+}
+
+static void
+test_notify_idle (void)
+{
+	StrandParkStats st;
+	strand_park_notify (&park, 1);
+	strand_park_notify (&park, UINT_MAX);
+	strand_park_stats (&park, &st);
+
+	// nothing is parked, so no wake calls are made
+	mu_assert_uint_eq (st.wakes, 0);
+}
+
+static void
+test_wake (void)
+{
+	StrandParkStats st;
+	pthread_t thread;
+
+	__atomic_store_n (&flag, 0, __ATOMIC_SEQ_CST);
+	mu_fassert_int_eq (pthread_create (&thread, NULL, waiter, NULL), 0);
+
+	// wait until the thread has gone to sleep
+	for (int i = 0; i < 1000; i++) {
+		strand_park_stats (&park, &st);
+		if (st.parks > 0) {
+			break;
+		}
+		usleep (1000);
+	}
+	mu_assert_uint_eq (st.parks, 1);
+
+	__atomic_store_n (&flag, 1, __ATOMIC_SEQ_CST);
+	strand_park_notify (&park, 1);
+	pthread_join (thread, NULL);
+
+	strand_park_stats (&park, &st);
+	mu_assert_uint_eq (st.parks, 1);
+	mu_assert_uint_eq (st.wakes, 1);
+	mu_assert_uint_eq (st.spurious, 0);
+}
+
+static void
+test_spurious (void)
+{
+	StrandParkStats st;
+	pthread_t thread;
+
+	strand_park_init (&park);
+	__atomic_store_n (&flag, 0, __ATOMIC_SEQ_CST);
+	mu_fassert_int_eq (pthread_create (&thread, NULL, waiter, NULL), 0);
+
+	for (int i = 0; i < 1000; i++) {
+		strand_park_stats (&park, &st);
+		if (st.parks > 0) {
+			break;
+		}
+		usleep (1000);
+	}
+
+	// a notification without the condition sends the thread back to sleep
+	strand_park_notify (&park, 1);
+	for (int i = 0; i < 1000; i++) {
+		strand_park_stats (&park, &st);
+		if (st.parks > 1) {
+			break;
+		}
+		usleep (1000);
+	}
+	mu_assert_uint_eq (st.spurious, 1);
+	mu_assert_uint_eq (st.parks, 2);
+
+	__atomic_store_n (&flag, 1, __ATOMIC_SEQ_CST);
+	strand_park_notify (&park, 1);
+	pthread_join (thread, NULL);
+
+	strand_park_stats (&park, &st);
+	mu_assert_uint_eq (st.wakes, 2);
+	mu_assert_uint_eq (st.spurious, 1);
+}
+
+int
+main (void)
+{
+	mu_init ("park");
+
+	test_ready ();
+	test_notify_idle ();
+	test_wake ();
+	test_spurious ();
+
+	mu_exit ();
+}
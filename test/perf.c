@@ -0,0 +1,127 @@
+#include "mu.h"
+
+#include "../src/strand.h"
+
+static uintptr_t
+work (void *data, uintptr_t val)
+{
+	(void)data;
+	volatile uint64_t x = 1;
+	for (int round = 0; round < 3; round++) {
+		for (int i = 0; i < 100000; i++) {
+			x = x * 31 + val;
+		}
+		val = strand_yield (val + 1);
+	}
+	return x;
+}
+
+static uintptr_t
+idle (void *data, uintptr_t val)
+{
+	(void)data;
+	while (true) {
+		val = strand_yield (val);
+	}
+	return 0;
+}
+
+static void
+test_disabled (void)
+{
+	StrandPerf perf;
+	Strand *s = strand_new (work, NULL);
+	while (strand_alive (s)) {
+		strand_resume (s, 0);
+	}
+	strand_perf (s, &perf);
+	mu_assert_uint_eq (perf.instructions, 0);
+	mu_assert_uint_eq (perf.cycles, 0);
+	mu_assert_uint_eq (perf.cache_misses, 0);
+	strand_free (&s);
+}
+
+static void
+test_enabled (void)
+{
+	int rc = strand_perf_enable (true);
+
+	StrandPerf busy, quiet;
+	Strand *a = strand_new (work, NULL);
+	Strand *b = strand_new (idle, NULL);
+	while (strand_alive (a)) {
+		strand_resume (a, 0);
+		strand_resume (b, 0);
+	}
+	strand_perf (a, &busy);
+	strand_perf (b, &quiet);
+
+	strand_perf_enable (false);
+
+	if (rc == 0) {
+		mu_assert_uint_gt (busy.instructions, 300000);
+		mu_assert_uint_gt (busy.cycles, 0);
+		mu_assert_uint_lt (quiet.instructions, busy.instructions);
+	}
+	else {
+		// counters are unavailable, so everything reads as zero
+		mu_assert_uint_eq (busy.instructions, 0);
+		mu_assert_uint_eq (busy.cycles, 0);
+		mu_assert_uint_eq (quiet.instructions, 0);
+	}
+
+	strand_free (&a);
+	strand_free (&b);
+}
+
+static uintptr_t
+pause_work (void *data, uintptr_t val)
+{
+	(void)val;
+	strand_perf_enable (false);
+	volatile uint64_t x = 1;
+	for (int i = 0; i < 10000000; i++) {
+		x = x * 31 + 1;
+	}
+	strand_perf_enable (true);
+
+	// the work done while disabled must not be charged to this switch
+	strand_resume (data, 0);
+	return x;
+}
+
+static void
+test_reenable (void)
+{
+	int rc = strand_perf_enable (true);
+
+	StrandPerf perf;
+	Strand *b = strand_new (idle, NULL);
+	Strand *a = strand_new (pause_work, b);
+	strand_resume (a, 0);
+	strand_perf (a, &perf);
+
+	strand_perf_enable (false);
+
+	if (rc == 0) {
+		mu_assert_uint_lt (perf.instructions, 1000000);
+	}
+	else {
+		mu_assert_uint_eq (perf.instructions, 0);
+	}
+
+	strand_free (&a);
+	strand_free (&b);
+}
+
+int
+main (void)
+{
+	mu_init ("perf");
+
+	test_disabled ();
+	test_enabled ();
+	test_reenable ();
+
+	mu_exit ();
+}
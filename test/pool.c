@@ -0,0 +1,159 @@
+#include "mu.h"
+
+#include "../src/pool.h"
+
+static Strand *ran_on[16];
+static int ran = 0;
+
+static void
+record (void *arg)
+{
+	(void)arg;
+	ran_on[ran++ % 16] = strand_current ();
+}
+
+static void
+test_reuse (void)
+{
+	StrandPool *p = strand_pool_new (1, 4);
+	mu_fassert (p != NULL);
+
+	ran = 0;
+	for (int i = 0; i < 10; i++) {
+		mu_assert_int_eq (strand_pool_submit (p, record, NULL), 0);
+	}
+
+	StrandPoolStats st;
+	strand_pool_stats (p, &st);
+	mu_assert_uint_eq (st.completed, 10);
+	mu_assert_uint_eq (st.created, 1);
+	mu_assert_uint_eq (st.workers, 1);
+	mu_assert_uint_eq (st.idle, 1);
+
+	// every job ran on the same warm worker
+	mu_assert_int_eq (ran, 10);
+	mu_assert (ran_on[0] != NULL);
+	for (int i = 1; i < 10; i++) {
+		mu_assert_ptr_eq (ran_on[i], ran_on[0]);
+	}
+
+	strand_pool_free (&p);
+	mu_assert_ptr_eq (p, NULL);
+}
+
+static Strand *waiting[16];
+static int nwaiting = 0;
+
+static void
+suspend (void *arg)
+{
+	waiting[nwaiting++] = strand_current ();
+	strand_yield (0);
+	(*(int *)arg)++;
+}
+
+/**
+ * Resumes every worker that suspended in a job
+ *
+ * @return  number of workers resumed
+ */
+static int
+wake_all (void)
+{
+	Strand *list[16];
+	int n = nwaiting;
+	memcpy (list, waiting, n * sizeof (*list));
+	nwaiting = 0;
+	for (int i = 0; i < n; i++) {
+		strand_resume (list[i], 0);
+	}
+	return n;
+}
+
+static void
+test_grow (void)
+{
+	int done = 0;
+	StrandPool *p = strand_pool_new (0, 3);
+	mu_fassert (p != NULL);
+
+	nwaiting = 0;
+	for (int i = 0; i < 5; i++) {
+		mu_assert_int_eq (strand_pool_submit (p, suspend, &done), 0);
+	}
+
+	StrandPoolStats st;
+	strand_pool_stats (p, &st);
+	mu_assert_uint_eq (st.workers, 3);
+	mu_assert_uint_eq (st.idle, 0);
+	mu_assert_uint_eq (st.queued, 2);
+	mu_assert_int_eq (nwaiting, 3);
+
+	// finished workers take the queued jobs before becoming idle
+	mu_assert_int_eq (wake_all (), 3);
+	mu_assert_int_eq (done, 3);
+	mu_assert_int_eq (nwaiting, 2);
+
+	strand_pool_stats (p, &st);
+	mu_assert_uint_eq (st.queued, 0);
+	mu_assert_uint_eq (st.idle, 1);
+
+	mu_assert_int_eq (wake_all (), 2);
+	mu_assert_int_eq (done, 5);
+
+	strand_pool_stats (p, &st);
+	mu_assert_uint_eq (st.completed, 5);
+	mu_assert_uint_eq (st.created, 3);
+	mu_assert_uint_eq (st.idle, 3);
+
+	strand_pool_free (&p);
+}
+
+static void
+nop (void *arg)
+{
+	(void)arg;
+}
+
+static void
+test_shrink (void)
+{
+	int done = 0;
+	StrandPool *p = strand_pool_new (1, 0);
+	mu_fassert (p != NULL);
+
+	nwaiting = 0;
+	for (int i = 0; i < 8; i++) {
+		strand_pool_submit (p, suspend, &done);
+	}
+	wake_all ();
+	mu_assert_int_eq (done, 8);
+
+	StrandPoolStats st;
+	strand_pool_stats (p, &st);
+	mu_assert_uint_eq (st.workers, 8);
+
+	// the first period still saw 8 busy workers, the second only one
+	for (int i = 0; i < 2*STRAND_POOL_PERIOD; i++) {
+		strand_pool_submit (p, nop, NULL);
+	}
+
+	strand_pool_stats (p, &st);
+	mu_assert_uint_eq (st.workers, 1);
+	mu_assert_uint_eq (st.idle, 1);
+	mu_assert_uint_eq (st.retired, 7);
+
+	strand_pool_free (&p);
+}
+
+int
+main (void)
+{
+	mu_init ("pool");
+
+	test_reuse ();
+	test_grow ();
+	test_shrink ();
+
+	mu_exit ();
+}
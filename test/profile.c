@@ -0,0 +1,133 @@
+#include "mu.h"
+
+#include "../src/strand.h"
+
+#include <time.h>
+#include <pthread.h>
+
+#if defined (__linux__) && (defined (__x86_64__) || defined (__i386__))
+
+static volatile uint64_t sink;
+
+uintptr_t
+profile_spin (void *data, uintptr_t val)
+{
+	(void)data;
+	struct timespec start, now;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &start);
+	do {
+		for (int i = 0; i < 10000; i++) {
+			sink += i;
+		}
+		clock_gettime (CLOCK_THREAD_CPUTIME_ID, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000000 + (now.tv_nsec - start.tv_nsec) < 200000000);
+	return val;
+}
+
+static void
+test_sample (void)
+{
+	mu_fassert_int_eq (strand_profile_start (1000), 0);
+	mu_assert_int_eq (strand_profile_start (1000), -EALREADY);
+
+	Strand *s = strand_new (profile_spin, NULL);
+	strand_resume (s, 0);
+	strand_free (&s);
+
+	strand_profile_stop ();
+
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream (&buf, &len);
+	mu_fassert (out != NULL);
+	mu_assert_int_eq (strand_profile_dump (out), 0);
+	fclose (out);
+
+	mu_assert (strstr (buf, "strand@") != NULL);
+#if STRAND_EXECINFO
+	// symbol names are only available when linked with `-rdynamic`
+	mu_assert (strstr (buf, "profile_spin") != NULL);
+#endif
+	free (buf);
+}
+
+static void
+test_restart (void)
+{
+	mu_assert_int_eq (strand_profile_start (0), -EINVAL);
+
+	// a period of a whole second is accepted, and starting again discards
+	// the samples of the earlier run
+	mu_fassert_int_eq (strand_profile_start (1), 0);
+	strand_profile_stop ();
+
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream (&buf, &len);
+	mu_fassert (out != NULL);
+	mu_assert_int_eq (strand_profile_dump (out), 0);
+	fclose (out);
+
+	mu_assert (strstr (buf, "strand@") == NULL);
+	free (buf);
+}
+
+static void *
+profile_exit (void *data)
+{
+	// the thread exits while still sampling, and optionally without samples
+	if (strand_profile_start (1000) == 0 && data != NULL) {
+		Strand *s = strand_new (profile_spin, NULL);
+		strand_resume (s, 0);
+		strand_free (&s);
+	}
+	return NULL;
+}
+
+static bool
+dump_has (const char *needle)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream (&buf, &len);
+	mu_fassert (out != NULL);
+	mu_assert_int_eq (strand_profile_dump (out), 0);
+	fclose (out);
+	bool found = strstr (buf, needle) != NULL;
+	free (buf);
+	return found;
+}
+
+static void
+test_exit (void)
+{
+	pthread_t t;
+	static int spin;
+
+	// samples of an exited thread are kept for dumping
+	mu_fassert_int_eq (pthread_create (&t, NULL, profile_exit, &spin), 0);
+	pthread_join (t, NULL);
+	mu_assert (dump_has ("strand@"));
+
+	// and its buffer is reused by the next thread to start sampling
+	mu_fassert_int_eq (pthread_create (&t, NULL, profile_exit, NULL), 0);
+	pthread_join (t, NULL);
+	mu_assert (!dump_has ("strand@"));
+}
+
+#endif
+
+int
+main (void)
+{
+	mu_init ("profile");
+
+#if defined (__linux__) && (defined (__x86_64__) || defined (__i386__))
+	test_sample ();
+	test_restart ();
+	test_exit ();
+#endif
+
+	mu_exit ();
+}
+
@@ -0,0 +1,219 @@
+#include "mu.h"
+
+#include "../src/shard.h"
+#include "../src/future.h"
+#include "../src/park.h"
+
+#define ROUNDS 10000
+
+static StrandPark park = STRAND_PARK_INIT;
+static int finished = 0;
+
+static bool
+is_finished (void *data)
+{
+	(void)data;
+	return __atomic_load_n (&finished, __ATOMIC_SEQ_CST) != 0;
+}
+
+static void
+finish (void)
+{
+	__atomic_store_n (&finished, 1, __ATOMIC_SEQ_CST);
+	strand_park_notify (&park, 1);
+}
+
+/**
+ * Sends a message from the main thread and waits for it to call `finish`
+ */
+static int
+run (unsigned shard, void (*fn)(void *), void *arg)
+{
+	__atomic_store_n (&finished, 0, __ATOMIC_SEQ_CST);
+	int rc = strand_shard_send (shard, fn, arg);
+	if (rc == 0) {
+		strand_park_wait (&park, is_finished, NULL);
+	}
+	return rc;
+}
+
+static void
+test_start (void)
+{
+	mu_assert_int_eq (strand_shard_count (), 0);
+	mu_fassert_int_eq (strand_shard_start (2), 0);
+	mu_assert_int_eq (strand_shard_start (2), -EALREADY);
+	mu_assert_int_eq (strand_shard_count (), 2);
+	mu_assert_int_eq (strand_shard_self (), -1);
+}
+
+static void
+record_self (void *data)
+{
+	*(int *)data = strand_shard_self ();
+	finish ();
+}
+
+static void
+test_inbox (void)
+{
+	int index = -1;
+	mu_assert_int_eq (strand_shard_send (2, record_self, &index), -EINVAL);
+	mu_assert_int_eq (run (1, record_self, &index), 0);
+	mu_assert_int_eq (index, 1);
+	mu_assert_int_eq (run (0, record_self, &index), 0);
+	mu_assert_int_eq (index, 0);
+}
+
+typedef struct {
+	unsigned count;
+	unsigned wrong;
+} Ball;
+
+static void
+bounce (void *data)
+{
+	Ball *b = data;
+	if ((int)(b->count % 2) != strand_shard_self ()) {
+		b->wrong++;
+	}
+	if (++b->count == ROUNDS) {
+		finish ();
+		return;
+	}
+	while (strand_shard_send (b->count % 2, bounce, b) == -EAGAIN) {
+		strand_shard_poll ();
+	}
+}
+
+static void
+test_ping_pong (void)
+{
+	Ball b = { 0, 0 };
+	mu_assert_int_eq (run (0, bounce, &b), 0);
+	mu_assert_uint_eq (b.count, ROUNDS);
+	mu_assert_uint_eq (b.wrong, 0);
+}
+
+typedef struct {
+	StrandFuture *future;
+	uintptr_t value;
+	int before, after;
+} Request;
+
+static void
+reply (void *data)
+{
+	Request *r = data;
+	strand_future_complete (r->future, r->value);
+}
+
+static void
+serve (void *data)
+{
+	Request *r = data;
+	r->value *= 2;
+	strand_shard_send (0, reply, r);
+}
+
+static uintptr_t
+client (void *data, uintptr_t val)
+{
+	(void)val;
+	Request *r = data;
+	r->future = strand_future_new ();
+	r->before = strand_shard_self ();
+	strand_shard_send (1, serve, r);
+	r->value = strand_future_await (r->future);
+	r->after = strand_shard_self ();
+	strand_future_free (&r->future);
+	finish ();
+	return 0;
+}
+
+static void
+spawn_client (void *data)
+{
+	strand_spawn (client, data);
+}
+
+static void
+test_request (void)
+{
+	Request r = { .value = 21, .before = -1, .after = -1 };
+
+	// the awaiting coroutine is resumed on its own shard by the reply
+	mu_assert_int_eq (run (0, spawn_client, &r), 0);
+	mu_assert_uint_eq (r.value, 42);
+	mu_assert_int_eq (r.before, 0);
+	mu_assert_int_eq (r.after, 0);
+}
+
+static int counted = 0;
+
+static void
+count (void *data)
+{
+	(void)data;
+	counted++;
+}
+
+static void
+fill (void *data)
+{
+	int *rc = data;
+
+	// the shard cannot drain its own ring while sending to it
+	for (int i = 0; i < STRAND_SHARD_RING; i++) {
+		rc[0] |= strand_shard_send (0, count, NULL);
+	}
+	rc[1] = strand_shard_send (0, count, NULL);
+	rc[2] = (int)strand_shard_poll ();
+	rc[3] = strand_shard_send (0, count, NULL);
+	finish ();
+}
+
+static void
+test_full (void)
+{
+	int rc[4] = { 0, 0, 0, 0 };
+	counted = 0;
+	mu_assert_int_eq (run (0, fill, rc), 0);
+	mu_assert_int_eq (rc[0], 0);
+	mu_assert_int_eq (rc[1], -EAGAIN);
+	mu_assert_int_eq (rc[2], STRAND_SHARD_RING);
+	mu_assert_int_eq (rc[3], 0);
+}
+
+static void
+test_stop (void)
+{
+	strand_shard_stop ();
+	mu_assert_int_eq (strand_shard_count (), 0);
+	mu_assert_int_eq (counted, STRAND_SHARD_RING + 1);
+	mu_assert_int_eq (strand_shard_send (0, count, NULL), -EINVAL);
+
+	// the shards may be started again
+	int index = -1;
+	mu_fassert_int_eq (strand_shard_start (1), 0);
+	mu_assert_int_eq (run (0, record_self, &index), 0);
+	mu_assert_int_eq (index, 0);
+	strand_shard_stop ();
+	strand_shard_stop ();
+}
+
+int
+main (void)
+{
+	mu_init ("shard");
+
+	test_start ();
+	test_inbox ();
+	test_ping_pong ();
+	test_request ();
+	test_full ();
+	test_stop ();
+
+	mu_exit ();
+}
+
@@ -1,6 +1,15 @@
 #include "mu.h"
 
 #include "../src/strand.h"
+#include "../src/strand_inline.h"
+
+#include <pthread.h>
+#include <errno.h>
+
+#if defined (__linux__)
+# include <sys/syscall.h>
+# include <linux/mempolicy.h>
+#endif
 
 static uintptr_t
 fib (void *data, uintptr_t val)
@@ -101,6 +110,600 @@ test_defer (void)
 	strand_free (&s);
 }
 
+#if defined (__linux__)
+
+static uintptr_t
+numa_policy (void *data, uintptr_t val)
+{
+	(void)val;
+	int mode = -1;
+	unsigned long mask = 0;
+	// query the policy of the mapping containing this stack frame
+	if (syscall (SYS_get_mempolicy, &mode, &mask, 64, &mode, MPOL_F_ADDR) < 0) {
+		return (uintptr_t)-1;
+	}
+	*(unsigned long *)data = mask;
+	return (uintptr_t)mode;
+}
+
+static void
+test_numa (void)
+{
+	unsigned long mask = 0;
+	int node = strand_numa_node ();
+
+	Strand *s = strand_new_config (STRAND_STACK_DEFAULT,
+			STRAND_FLAGS_DEFAULT | STRAND_FNUMA, numa_policy, &mask);
+	mu_assert_int_eq (strand_resume (s, 0), MPOL_PREFERRED);
+	mu_assert_uint_eq (mask, 1UL << node);
+	strand_free (&s);
+
+	// a revived stack keeps its policy
+	s = strand_new_config (STRAND_STACK_DEFAULT,
+			STRAND_FLAGS_DEFAULT | STRAND_FNUMA, numa_policy, &mask);
+	mu_assert_int_eq (strand_resume (s, 0), MPOL_PREFERRED);
+	strand_free (&s);
+}
+
+#endif
+
+static uintptr_t
+touch_stack (void *data, uintptr_t val)
+{
+	(void)data;
+	volatile uint8_t buf[32768];
+	memset ((void *)buf, 1, sizeof buf);
+	return val + buf[val];
+}
+
+static void
+test_memstats (void)
+{
+	StrandMemStats before, after;
+
+	mu_assert_int_eq (strand_memstats (&before), 0);
+
+	Strand *s = strand_new_config (STRAND_STACK_DEFAULT, STRAND_FLAGS_DEFAULT, touch_stack, NULL);
+	strand_resume (s, 0);
+
+	mu_assert_int_eq (strand_memstats (&after), 0);
+	mu_assert_uint_ge (after.mapped, before.mapped);
+	mu_assert_uint_ge (after.resident, 32768);
+	mu_assert_uint_le (after.resident, after.mapped);
+	mu_assert_uint_le (after.cached, before.cached);
+
+	size_t mapped = 0, resident = 0;
+	for (int i = 0; i < STRAND_MEMSTATS_CLASSES; i++) {
+		mapped += after.sizes[i].mapped;
+		resident += after.sizes[i].resident;
+	}
+	mu_assert_uint_eq (mapped, after.mapped);
+	mu_assert_uint_eq (resident, after.resident);
+
+	strand_free (&s);
+
+	mu_assert_int_eq (strand_memstats (&after), 0);
+	mu_assert_uint_gt (after.cached, 0);
+	mu_assert_uint_le (after.cached + after.shared, after.mapped);
+}
+
+#define THREAD_COUNT 16
+
+static uintptr_t
+noop (void *data, uintptr_t val)
+{
+	(void)data;
+	return val;
+}
+
+static void *
+thread_free (void *data)
+{
+	Strand **list = data;
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		strand_free (&list[i]);
+	}
+	return NULL;
+}
+
+static void *
+thread_new (void *data)
+{
+	StrandMemStats *st = data;
+	Strand *list[THREAD_COUNT];
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		list[i] = strand_new (noop, NULL);
+	}
+	strand_memstats (st);
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		strand_free (&list[i]);
+	}
+	return NULL;
+}
+
+static void
+test_cache_threads (void)
+{
+	StrandMemStats before, after, during;
+	Strand *list[THREAD_COUNT];
+	pthread_t t;
+
+	for (int i = 0; i < THREAD_COUNT; i++) {
+		list[i] = strand_new (noop, NULL);
+	}
+
+	// stacks freed by an exiting thread are handed to the shared cache
+	strand_memstats (&before);
+	pthread_create (&t, NULL, thread_free, list);
+	pthread_join (t, NULL);
+	strand_memstats (&after);
+	mu_assert_uint_eq (after.mapped, before.mapped);
+	mu_assert_uint_ge (after.shared, before.shared + THREAD_COUNT * STRAND_STACK_DEFAULT);
+
+	// and then reused by a new thread
+	pthread_create (&t, NULL, thread_new, &during);
+	pthread_join (t, NULL);
+	mu_assert_uint_eq (during.mapped, after.mapped);
+	mu_assert_uint_lt (during.shared, after.shared);
+}
+
+static void
+test_cache_trim (void)
+{
+	StrandMemStats st;
+	Strand *list[128];
+
+	for (int i = 0; i < 128; i++) {
+		list[i] = strand_new (noop, NULL);
+	}
+	for (int i = 0; i < 128; i++) {
+		strand_free (&list[i]);
+	}
+
+	// the thread cache is bounded and the excess is shared
+	strand_memstats (&st);
+	mu_assert_uint_lt (st.cached, 128 * STRAND_STACK_DEFAULT);
+	mu_assert_uint_gt (st.shared, 0);
+}
+
+static bool
+has_backtrace (const Strand *s)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream (&buf, &len);
+	strand_print (s, out);
+	fclose (out);
+	bool found = strstr (buf, "backtrace:") != NULL;
+	free (buf);
+	return found;
+}
+
+static void
+test_capture (void)
+{
+	Strand *list[4];
+
+	for (int i = 0; i < 4; i++) {
+		list[i] = strand_new_config (STRAND_STACK_DEFAULT, STRAND_FLAGS_DEBUG, noop, NULL);
+	}
+	for (int i = 0; i < 4; i++) {
+		mu_assert (has_backtrace (list[i]) == (STRAND_EXECINFO != 0));
+		strand_free (&list[i]);
+	}
+
+	strand_capture_rate (2);
+	int captured = 0;
+	for (int i = 0; i < 4; i++) {
+		list[i] = strand_new_config (STRAND_STACK_DEFAULT, STRAND_FLAGS_DEBUG, noop, NULL);
+	}
+	for (int i = 0; i < 4; i++) {
+		captured += has_backtrace (list[i]);
+		strand_free (&list[i]);
+	}
+	strand_capture_rate (1);
+
+	mu_assert_int_eq (captured, STRAND_EXECINFO ? 2 : 0);
+
+	// resetting replaces the backtrace, here with none as the rate skips it
+	list[0] = strand_new_config (STRAND_STACK_DEFAULT, STRAND_FLAGS_DEBUG, noop, NULL);
+	strand_resume (list[0], 0);
+	strand_capture_rate (1000);
+	strand_reset (list[0], noop, NULL);
+	strand_capture_rate (1);
+	mu_assert (!has_backtrace (list[0]));
+	strand_free (&list[0]);
+}
+
+static size_t
+large_resident (void)
+{
+	StrandMemStats st;
+	size_t resident = 0;
+	mu_assert_int_eq (strand_memstats (&st), 0);
+	for (int i = 0; i < STRAND_MEMSTATS_CLASSES; i++) {
+		if (st.sizes[i].map_size >= 4*1024*1024) {
+			resident += st.sizes[i].resident;
+		}
+	}
+	return resident;
+}
+
+static void
+test_prefault (void)
+{
+	size_t r0 = large_resident ();
+	Strand *a = strand_new_config (4*1024*1024, STRAND_FPROTECT, noop, NULL);
+	size_t r1 = large_resident ();
+	Strand *b = strand_new_config (4*1024*1024, STRAND_FPROTECT|STRAND_FPREFAULT, noop, NULL);
+	size_t r2 = large_resident ();
+
+	mu_assert_uint_le (r1 - r0, 8192);
+	mu_assert_uint_ge (r2 - r1, 16384 + 4096);
+
+	// the prefaulted pages stay resident when the mapping is reused
+	strand_free (&b);
+	b = strand_new_config (4*1024*1024, STRAND_FPROTECT|STRAND_FPREFAULT, noop, NULL);
+	mu_assert_uint_eq (large_resident (), r2);
+
+	strand_free (&a);
+	strand_free (&b);
+}
+
+static uintptr_t
+add (void *data, uintptr_t val)
+{
+	uintptr_t total = (uintptr_t)data + val;
+	while (val != 0) {
+		val = strand_yield (total);
+		total += val;
+	}
+	return total;
+}
+
+static void
+test_reset (void)
+{
+	Strand *s = strand_new (add, (void *)100);
+	mu_assert_uint_eq (strand_resume (s, 1), 101);
+	mu_assert_uint_eq (strand_resume (s, 0), 101);
+	mu_assert (!strand_alive (s));
+
+	for (uintptr_t i = 1; i <= 3; i++) {
+		Strand *before = s;
+		strand_reset (s, add, (void *)(i * 1000));
+		mu_assert_ptr_eq (s, before);
+		mu_assert (strand_alive (s));
+		mu_assert_uint_eq (strand_resume (s, 5), i * 1000 + 5);
+		mu_assert_uint_eq (strand_resume (s, 2), i * 1000 + 7);
+		mu_assert_uint_eq (strand_resume (s, 0), i * 1000 + 7);
+		mu_assert (!strand_alive (s));
+	}
+
+	strand_free (&s);
+}
+
+#define LOCAL_KEYS 6
+
+static StrandLocalKey local_keys[LOCAL_KEYS];
+static int local_released;
+
+static void
+local_release (void *val)
+{
+	local_released += (int)(uintptr_t)val;
+}
+
+static uintptr_t
+use_locals (void *data, uintptr_t val)
+{
+	(void)data;
+	for (int i = 0; i < LOCAL_KEYS; i++) {
+		mu_assert_ptr_eq (strand_local_get (local_keys[i]), NULL);
+		mu_assert_int_eq (strand_local_set (local_keys[i], (void *)(val + i)), 0);
+	}
+	// keys that were never created are rejected
+	mu_assert_ptr_eq (strand_local_get (STRAND_LOCAL_MAX), NULL);
+	mu_assert_int_eq (strand_local_set (STRAND_LOCAL_MAX, &local_released), -EINVAL);
+	strand_yield (0);
+	uintptr_t sum = 0;
+	for (int i = 0; i < LOCAL_KEYS; i++) {
+		sum += (uintptr_t)strand_local_get (local_keys[i]);
+	}
+	return sum;
+}
+
+static void
+test_local (void)
+{
+	for (int i = 0; i < LOCAL_KEYS; i++) {
+		mu_assert_int_eq (strand_local_key_create (&local_keys[i], local_release), 0);
+	}
+
+	mu_assert_ptr_eq (strand_local_get (local_keys[0]), NULL);
+	mu_assert_int_eq (strand_local_set (local_keys[0], &local_released), -EPERM);
+
+	// values are released when the coroutine returns
+	Strand *s = strand_new (use_locals, NULL);
+	local_released = 0;
+	strand_resume (s, 1);
+	mu_assert_uint_eq (strand_resume (s, 0), 1+2+3+4+5+6);
+	mu_assert_int_eq (local_released, 1+2+3+4+5+6);
+	strand_free (&s);
+
+	// and when a suspended coroutine is freed
+	s = strand_new (use_locals, NULL);
+	local_released = 0;
+	strand_resume (s, 10);
+	strand_free (&s);
+	mu_assert_int_eq (local_released, 10+11+12+13+14+15);
+
+	// reused coroutines start out empty
+	s = strand_new (use_locals, NULL);
+	strand_resume (s, 1);
+	strand_free (&s);
+}
+
+static void
+test_color (void)
+{
+	Strand *list[8];
+	uint64_t offsets = 0;
+
+	for (int i = 0; i < 8; i++) {
+		list[i] = strand_new_config (2*1024*1024, STRAND_FPROTECT|STRAND_FCOLOR, touch_stack, NULL);
+		mu_assert_ptr_ne (list[i], NULL);
+		offsets |= UINT64_C(1) << (((uintptr_t)list[i] % 4096) / 64);
+	}
+	mu_assert_int_gt (__builtin_popcountll (offsets), 1);
+
+	for (int i = 0; i < 8; i++) {
+		strand_resume (list[i], 0);
+		mu_assert (!strand_alive (list[i]));
+		strand_free (&list[i]);
+	}
+}
+
+static uintptr_t
+count_inline (void *data, uintptr_t val)
+{
+	(void)data;
+	while (val < 3) {
+		val = strand_yield_inline (val + 1);
+	}
+	return val * 10;
+}
+
+static void
+test_inline (void)
+{
+	Strand *s = strand_new (count_inline, NULL);
+	mu_assert_ptr_ne (s, NULL);
+
+	mu_assert_uint_eq (strand_resume_inline (s, 0), 1);
+	mu_assert_uint_eq (strand_resume (s, 1), 2);
+	mu_assert (strand_alive_inline (s));
+	mu_assert_uint_eq (strand_resume_inline (s, 2), 3);
+	mu_assert_uint_eq (strand_resume_inline (s, 3), 30);
+	mu_assert (!strand_alive_inline (s));
+	mu_assert (!strand_alive_inline (NULL));
+	mu_assert_ptr_eq (strand_current (), NULL);
+
+	strand_free (&s);
+}
+
+static uintptr_t
+countdown (void *data, uintptr_t val)
+{
+	(void)val;
+	for (uintptr_t n = (uintptr_t)data; n > 0; n--) {
+		strand_yield (n);
+	}
+	return 100;
+}
+
+static void
+test_resume_batch (void)
+{
+	Strand *list[20];
+	uintptr_t results[20];
+
+	for (uintptr_t i = 0; i < 20; i++) {
+		list[i] = strand_new (countdown, (void *)(i % 3));
+		results[i] = 0;
+	}
+	strand_free (&list[3]);
+	while (strand_alive (list[5])) {
+		strand_resume (list[5], 0);
+	}
+
+	// the NULL and dead entries are skipped
+	mu_assert_uint_eq (strand_resume_batch (list, 20, results), 18);
+	mu_assert_uint_eq (results[0], 100);
+	mu_assert_uint_eq (results[1], 1);
+	mu_assert_uint_eq (results[2], 2);
+	mu_assert_uint_eq (results[3], 0);
+	mu_assert_uint_eq (results[5], 0);
+
+	size_t rounds = 1;
+	while (strand_resume_batch (list, 20, NULL) > 0) {
+		rounds++;
+	}
+	mu_assert_uint_eq (rounds, 3);
+	mu_assert_uint_eq (strand_resume_batch (list, 0, NULL), 0);
+	mu_assert_ptr_eq (strand_current (), NULL);
+
+	for (int i = 0; i < 20; i++) {
+		mu_assert (list[i] == NULL || !strand_alive (list[i]));
+		strand_free (&list[i]);
+	}
+}
+
+static char order[16];
+static int norder;
+
+static uintptr_t
+interleave (void *data, uintptr_t val)
+{
+	const char *name = data;
+	mu_assert_uint_eq (val, 0);
+	for (int i = 0; i < name[1] - '0'; i++) {
+		order[norder++] = name[0];
+		if (name[2] == 'y') {
+			strand_yield (0);
+		}
+		else {
+			strand_prefetch_yield (order);
+		}
+	}
+	return 0;
+}
+
+static void
+test_group (void)
+{
+	static const char *names[] = { "a2", "b1", "c3y", "d2" };
+	Strand *list[4];
+
+	norder = 0;
+	memset (order, 0, sizeof order);
+	for (int i = 0; i < 4; i++) {
+		list[i] = strand_new (interleave, (void *)names[i]);
+	}
+
+	// a member that yields normally passes through the driver, which then
+	// resumes the member after it
+	strand_group_run (list, 4);
+	mu_assert_str_eq (order, "abcdadcc");
+	mu_assert_ptr_eq (strand_current (), NULL);
+	for (int i = 0; i < 4; i++) {
+		mu_assert (!strand_alive (list[i]));
+		strand_free (&list[i]);
+	}
+
+	// outside of a group, this yields to the parent
+	Strand *s = strand_new (interleave, "e2");
+	mu_assert_uint_eq (strand_resume (s, 0), 0);
+	mu_assert (strand_alive (s));
+	strand_free (&s);
+
+	// a member that is already dead is never switched to
+	list[0] = strand_new (interleave, "g3");
+	list[1] = strand_new (interleave, "f0");
+	list[2] = strand_new (interleave, "h2");
+	strand_resume (list[1], 0);
+	mu_assert (!strand_alive (list[1]));
+	norder = 0;
+	memset (order, 0, sizeof order);
+	strand_group_run (list, 3);
+	mu_assert_str_eq (order, "ghghg");
+	for (int i = 0; i < 3; i++) {
+		mu_assert (!strand_alive (list[i]));
+		strand_free (&list[i]);
+	}
+	memset (order, 0, sizeof order);
+}
+
+static uintptr_t
+record (void *data, uintptr_t val)
+{
+	(void)val;
+	order[norder++] = *(const char *)data;
+	strand_sched_yield (0);
+	order[norder++] = *(const char *)data;
+	return 0;
+}
+
+static void
+test_sched_fifo (void)
+{
+	norder = 0;
+	strand_sched_mode (STRAND_SCHED_FIFO);
+
+	mu_assert_ptr_ne (strand_spawn (record, "a"), NULL);
+	mu_assert_ptr_ne (strand_spawn (record, "b"), NULL);
+	mu_assert_ptr_ne (strand_spawn (record, "c"), NULL);
+
+	mu_assert_uint_eq (strand_sched_run (), 6);
+	mu_assert_int_eq (norder, 6);
+	mu_assert_str_eq (order, "abcabc");
+}
+
+static void
+test_sched_priority (void)
+{
+	norder = 0;
+	memset (order, 0, sizeof order);
+	strand_sched_mode (STRAND_SCHED_PRIORITY);
+
+	Strand *s[5];
+	const char *names[5] = { "a", "b", "c", "d", "e" };
+	for (int i = 0; i < 5; i++) {
+		s[i] = strand_new (record, (void *)names[i]);
+		mu_assert_ptr_ne (s[i], NULL);
+	}
+
+	uint64_t now = strand_clock ();
+	strand_set_priority (s[0], 40);
+	strand_set_priority (s[1], 10);
+	strand_set_priority (s[2], STRAND_PRIORITY_COUNT + 5);
+	strand_set_deadline (s[3], now + 2000000);
+	strand_set_deadline (s[4], now + 1000000);
+	mu_assert_int_eq (strand_priority (s[2]), STRAND_PRIORITY_COUNT - 1);
+	mu_assert_uint_eq (strand_deadline (s[3]), now + 2000000);
+
+	for (int i = 0; i < 5; i++) {
+		mu_assert_int_eq (strand_ready (s[i], 0), 0);
+	}
+
+	mu_assert_uint_eq (strand_sched_run (), 10);
+	// a yielding coroutine keeps its place ahead of lower priorities
+	mu_assert_str_eq (order, "eeddbbaacc");
+
+	for (int i = 0; i < 5; i++) {
+		mu_assert (!strand_alive (s[i]));
+		strand_free (&s[i]);
+	}
+
+	strand_sched_mode (STRAND_SCHED_FIFO);
+}
+
+static uintptr_t
+spin (void *data, uintptr_t val)
+{
+	(void)val;
+	uint64_t end = strand_clock () + 30000000;
+	while (strand_clock () < end) {
+		if (strand_maybe_yield ()) {
+			(*(int *)data)++;
+		}
+	}
+	return 0;
+}
+
+static void
+test_budget (uint32_t flags)
+{
+	int yields[2] = { 0, 0 };
+	StrandBudgetStats stats;
+
+	mu_assert_int_eq (strand_budget (100000, flags), 0);
+	mu_assert_ptr_ne (strand_spawn (spin, &yields[0]), NULL);
+	mu_assert_ptr_ne (strand_spawn (spin, &yields[1]), NULL);
+	size_t n = strand_sched_run ();
+	strand_budget_stats (&stats);
+	mu_assert_int_eq (strand_budget (0, 0), 0);
+
+	mu_assert_int_gt (yields[0], 0);
+	mu_assert_int_gt (yields[1], 0);
+	mu_assert_uint_eq (n, (size_t)yields[0] + yields[1] + 2);
+	mu_assert_uint_ge (stats.expired, (uint64_t)yields[0] + yields[1]);
+	mu_assert_uint_ge (stats.checks, stats.expired);
+
+	// without a budget or outside of the scheduler, nothing yields
+	mu_assert (!strand_maybe_yield ());
+}
+
 int
 main (void)
 {
@@ -110,6 +713,26 @@ main (void)
 
 	test_fibonacci ();
 	test_defer ();
+	test_memstats ();
+	test_cache_threads ();
+	test_cache_trim ();
+	test_capture ();
+	test_prefault ();
+	test_color ();
+	test_local ();
+	test_reset ();
+	test_inline ();
+	test_resume_batch ();
+	test_group ();
+	test_sched_fifo ();
+	test_sched_priority ();
+	test_budget (0);
+#if defined (__linux__)
+	test_budget (STRAND_BUDGET_FTIMER);
+#endif
+#if defined (__linux__)
+	test_numa ();
+#endif
 
 	mu_exit ();
 }
@@ -0,0 +1,202 @@
+#include "mu.h"
+
+#include "../src/task.h"
+
+typedef struct {
+	StrandTask task;
+	unsigned beats;
+} Heartbeat;
+
+static uintptr_t
+heartbeat (StrandTask *t, uintptr_t val)
+{
+	Heartbeat *h = (Heartbeat *)t;
+	STRAND_TASK_BEGIN (t);
+	while (val != 0) {
+		h->beats++;
+		STRAND_TASK_YIELD (t, h->beats);
+	}
+	STRAND_TASK_END (t);
+}
+
+static void
+test_yield (void)
+{
+	Heartbeat h = { STRAND_TASK_INIT (heartbeat), 0 };
+
+	mu_assert (strand_task_alive (&h.task));
+	mu_assert_uint_eq (strand_task_resume (&h.task, 1), 1);
+	mu_assert_uint_eq (strand_task_resume (&h.task, 1), 2);
+	mu_assert_uint_eq (strand_task_resume (&h.task, 1), 3);
+	mu_assert (strand_task_alive (&h.task));
+	mu_assert_uint_eq (strand_task_resume (&h.task, 0), 0);
+	mu_assert (!strand_task_alive (&h.task));
+	mu_assert_uint_eq (h.beats, 3);
+
+	// a task can be reinitialized once dead
+	strand_task_init (&h.task, heartbeat);
+	mu_assert_uint_eq (strand_task_resume (&h.task, 0), 0);
+	mu_assert (!strand_task_alive (&h.task));
+}
+
+static char order[8];
+static int norder = 0;
+
+static void
+record (void *data)
+{
+	order[norder++] = *(const char *)data;
+}
+
+typedef struct {
+	StrandTask task;
+	uintptr_t i, n;
+} Counter;
+
+static uintptr_t
+count_to (StrandTask *t, uintptr_t val)
+{
+	Counter *c = (Counter *)t;
+	STRAND_TASK_BEGIN (t);
+	strand_defer (record, "a");
+	strand_defer (record, "b");
+
+	// `val` is replaced on each resume, so the limit is kept in the task
+	c->n = val;
+	for (c->i = 0; c->i < c->n; c->i++) {
+		STRAND_TASK_YIELD (t, c->i);
+	}
+	STRAND_TASK_RETURN (t, 100);
+	STRAND_TASK_END (t);
+}
+
+static void
+test_defer (void)
+{
+	Counter c;
+	strand_task_init (&c.task, count_to);
+	norder = 0;
+
+	mu_assert_uint_eq (strand_task_resume (&c.task, 2), 0);
+	mu_assert_int_eq (norder, 0);
+	mu_assert_uint_eq (strand_task_resume (&c.task, 0), 1);
+	mu_assert_uint_eq (strand_task_resume (&c.task, 0), 100);
+
+	// deferred calls run in LIFO order once the task returns
+	mu_assert_int_eq (norder, 2);
+	mu_assert_int_eq (order[0], 'b');
+	mu_assert_int_eq (order[1], 'a');
+
+	// cancelling runs the deferred calls of a suspended task
+	norder = 0;
+	strand_task_init (&c.task, count_to);
+	mu_assert_uint_eq (strand_task_resume (&c.task, 5), 0);
+	strand_task_cancel (&c.task);
+	mu_assert (!strand_task_alive (&c.task));
+	mu_assert_int_eq (norder, 2);
+	strand_task_cancel (&c.task);
+	mu_assert_int_eq (norder, 2);
+}
+
+static uintptr_t
+strand_defers (void *data, uintptr_t val)
+{
+	(void)val;
+	strand_defer (record, "s");
+	return data ? strand_task_resume (data, 1) : 0;
+}
+
+static uintptr_t
+nested (StrandTask *t, uintptr_t val)
+{
+	(void)val;
+	STRAND_TASK_BEGIN (t);
+	strand_defer (record, "t");
+	{
+		// the coroutine's deferred call stays with the coroutine
+		Strand *s = strand_new (strand_defers, NULL);
+		strand_resume (s, 0);
+		strand_free (&s);
+	}
+	STRAND_TASK_END (t);
+}
+
+static uintptr_t
+inner (StrandTask *t, uintptr_t val)
+{
+	STRAND_TASK_BEGIN (t);
+	strand_defer (record, "i");
+	STRAND_TASK_YIELD (t, val + 1);
+	STRAND_TASK_END (t);
+}
+
+static void
+test_nested (void)
+{
+	norder = 0;
+	StrandTask t = STRAND_TASK_INIT (nested);
+	mu_assert_uint_eq (strand_task_resume (&t, 0), 0);
+	mu_assert_int_eq (norder, 2);
+	mu_assert_int_eq (order[0], 's');
+	mu_assert_int_eq (order[1], 't');
+
+	// a task resumed from a coroutine attaches calls to the task
+	norder = 0;
+	StrandTask in = STRAND_TASK_INIT (inner);
+	Strand *s = strand_new (strand_defers, &in);
+	mu_assert_uint_eq (strand_resume (s, 0), 2);
+	mu_assert (!strand_alive (s));
+	mu_assert_int_eq (norder, 1);
+	mu_assert_int_eq (order[0], 's');
+	strand_free (&s);
+	mu_assert_uint_eq (strand_task_resume (&in, 0), 0);
+	mu_assert_int_eq (norder, 2);
+	mu_assert_int_eq (order[1], 'i');
+}
+
+static uintptr_t
+host_yield (StrandTask *t, uintptr_t val)
+{
+	STRAND_TASK_BEGIN (t);
+	// suspends the coroutine running the task function
+	strand_yield (val);
+	STRAND_TASK_END (t);
+}
+
+static uintptr_t
+hosts (void *data, uintptr_t val)
+{
+	return strand_task_resume (data, val);
+}
+
+static void
+test_freed_host (void)
+{
+	norder = 0;
+	StrandTask t = STRAND_TASK_INIT (host_yield);
+	Strand *s = strand_new (hosts, &t);
+	mu_assert_uint_eq (strand_resume (s, 7), 7);
+	strand_free (&s);
+
+	// a coroutine that reuses the freed one keeps its own deferred calls
+	s = strand_new (strand_defers, NULL);
+	mu_assert_uint_eq (strand_resume (s, 0), 0);
+	mu_assert (!strand_alive (s));
+	mu_assert_int_eq (norder, 1);
+	mu_assert_int_eq (order[0], 's');
+	strand_free (&s);
+}
+
+int
+main (void)
+{
+	mu_init ("task");
+
+	test_yield ();
+	test_defer ();
+	test_nested ();
+	test_freed_host ();
+
+	mu_exit ();
+}
+
@@ -0,0 +1,129 @@
+#include "mu.h"
+
+#include "../src/strand.h"
+
+#include <pthread.h>
+
+static uintptr_t
+count (void *data, uintptr_t val)
+{
+	(void)data;
+	while (val < 3) {
+		val = strand_yield (val + 1);
+	}
+	return val;
+}
+
+static char *
+dump (void)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream (&buf, &len);
+	mu_fassert (out != NULL);
+	mu_assert_int_eq (strand_trace_dump (out), 0);
+	fclose (out);
+	return buf;
+}
+
+static void
+test_disabled (void)
+{
+	Strand *s = strand_new (count, NULL);
+	strand_resume (s, 0);
+	strand_free (&s);
+
+	char *buf = dump ();
+	mu_assert (strstr (buf, "\"traceEvents\":[") != NULL);
+	mu_assert (strstr (buf, "\"cat\":\"resume\"") == NULL);
+	free (buf);
+}
+
+#if STRAND_TRACE
+
+static void
+test_enabled (void)
+{
+	strand_trace_enable (true);
+
+	Strand *s = strand_new (count, NULL);
+	uintptr_t val = 0;
+	while (strand_alive (s)) {
+		val = strand_resume (s, val);
+	}
+	strand_free (&s);
+
+	strand_trace_enable (false);
+
+	char *buf = dump ();
+	mu_assert (strstr (buf, "\"ph\":\"M\"") != NULL);
+	mu_assert (strstr (buf, "\"cat\":\"resume\"") != NULL);
+	mu_assert (strstr (buf, "\"cat\":\"yield\"") != NULL);
+	mu_assert (strstr (buf, "\"cat\":\"dead\"") != NULL);
+	mu_assert (strstr (buf, "\"cat\":\"free\"") != NULL);
+	mu_assert (strstr (buf, "\"name\":\"main\"") != NULL);
+	free (buf);
+}
+
+static void *
+trace_thread (void *data)
+{
+	(void)data;
+	Strand *s = strand_new (count, NULL);
+	strand_resume (s, 0);
+	strand_free (&s);
+	return NULL;
+}
+
+static size_t
+count_threads (const char *buf)
+{
+	size_t n = 0;
+	for (const char *p = buf; (p = strstr (p, "\"ph\":\"M\"")) != NULL; p++) {
+		n++;
+	}
+	return n;
+}
+
+static void
+test_exited (void)
+{
+	pthread_t t;
+	strand_trace_enable (true);
+
+	// events of an exited thread are kept
+	mu_fassert_int_eq (pthread_create (&t, NULL, trace_thread, NULL), 0);
+	pthread_join (t, NULL);
+	char *buf = dump ();
+	size_t threads = count_threads (buf);
+	mu_assert (strstr (buf, "\"name\":\"thread 2\"") != NULL);
+	free (buf);
+
+	// and the buffer is reused by the next thread rather than adding one
+	mu_fassert_int_eq (pthread_create (&t, NULL, trace_thread, NULL), 0);
+	pthread_join (t, NULL);
+	buf = dump ();
+	mu_assert_uint_eq (count_threads (buf), threads);
+	mu_assert (strstr (buf, "\"name\":\"thread 2\"") == NULL);
+	mu_assert (strstr (buf, "\"name\":\"thread 3\"") != NULL);
+	free (buf);
+
+	strand_trace_enable (false);
+}
+
+#endif
+
+int
+main (void)
+{
+	mu_init ("trace");
+
+	test_disabled ();
+#if STRAND_TRACE
+	test_enabled ();
+	test_exited ();
+#endif
+
+	mu_exit ();
+}
+